@@ -31,6 +31,7 @@
 #include <cassert>
 
 #include "calibrator.hpp"
+#include "output.hpp"
 
 #ifndef EXIT_SUCCESS
 #define EXIT_SUCCESS 1
@@ -40,39 +41,25 @@
 #endif
 
 
-/// Names of the points
-enum {
-    UL = 0, // Upper-left
-    UR = 1, // Upper-right
-    LL = 2, // Lower-left
-    LR = 3,  // Lower-right
-    NUM_POINTS
-};
-
 void Calibrator::getMatrix(const std::string &name, Mat9 &coeff) {
 
-    std::vector<std::string> values;
-    auto ret = xinputtouch->get_prop(device_id, name.c_str(), values);
+    XPropData value;
+    auto ret = xinputtouch->get_prop(device_id, name.c_str(), value);
 
-    if (ret < 0 || values.size() != 9)
+    if (ret < 0 || value.type != XAtoms::get(display).float_atom ||
+            value.format != 32 || value.size() != 9)
         throw WrongCalibratorException("Libinput: \"" + name + "\" property missing, not a (valid) libinput device");
 
-    mat9_set_identity(coeff);
     for (unsigned int i = 0 ; i < 9 ; i++)
-        coeff[i] = std::stod(values[i]);
+        coeff[i] = value.get_float(i);
 
 }
 
-void Calibrator::setMatrix(const std::string &name, const Mat9 &coeff) {
-
-    Atom float_atom = XInternAtom(display, "FLOAT", false);
-    int format = 32;
-    std::vector<std::string> values;
-
-    for (auto x : coeff.coeff)
-        values.push_back(std::to_string(x));
+void Calibrator::setMatrix(const std::string &name, const Mat9 &coeff,
+                           bool sync) {
 
-    auto ret = xinputtouch->set_prop(device_id, name.c_str(), float_atom, format, values);
+    auto ret = xinputtouch->set_prop(device_id, name.c_str(), coeff.coeff, 9,
+                                     sync);
     if (ret < 0)
         throw WrongCalibratorException("Libinput: \"" + name + "\" property missing, not a (valid) libinput device");
 
@@ -86,7 +73,8 @@ Calibrator::Calibrator(Display *display_,
                          const int thr_misclick_,
                          const int thr_doubleclick_,
                          std::string matrix_name_,
-                         bool verbose_) :
+                         bool verbose_,
+                         XInputTouch *xinputtouch_) :
         display(display_),
         threshold_doubleclick(thr_doubleclick_),
         threshold_misclick(thr_misclick_),
@@ -97,7 +85,11 @@ Calibrator::Calibrator(Display *display_,
     matrix_name = matrix_name_;
 
     // init
-    xinputtouch = new XInputTouch(display);
+    xinputtouch = xinputtouch_;
+    if (!xinputtouch) {
+        own_xinputtouch.reset(new XInputTouch(display));
+        xinputtouch = own_xinputtouch.get();
+    }
 
     getMatrix(matrix_name, old_coeff);
     reset_data = true;
@@ -119,214 +111,52 @@ bool Calibrator::finish(int width, int height)
         printf("\tDevice-ID:%lu\n", device_id);
     }
 
-    if (get_numclicks() != NUM_POINTS) {
+    if (get_numclicks() != grid.size()) {
         return false;
     }
 
-    /*
-     * Assuming that
-     *
-     *  [a  b  c]     [tx_i]     [sx_i]
-     *  [d  e  f]  x  [ty_i]  =  [sy_i]
-     *  [0  0  1]     [  1 ]     [ 1  ]
-     *
-     *      ^          ^        ^
-     *      C          Ti       Si
-     *
-     *  Where:
-     *   - a,b ...f      -> conversion matrix
-     *   - tx_i, ty_i    -> 'i'th touch x,y
-     *   - sx_i, sy_i    -> 'i'th screen x,y
-     *  this means:
-     *
-     *            ⎡tx_1  tx_2  tx_3⎤     ⎡sx_1  sx_2  sx_3⎤
-     *            ⎢                ⎥     ⎢                ⎥
-     *        C x ⎢ty_1  ty_2  ty_3⎥  =  ⎢sy_1  sy_2  sy_3⎥
-     *            ⎢                ⎥     ⎢                ⎥
-     *            ⎣  1     1     1 ⎦     ⎣  1     1     1 ⎦
-     *
-     *            ⎡sx_1  sx_2  sx_3⎤     ⎡tx_1  tx_2  tx_3⎤ ^ -1
-     *            ⎢                ⎥     ⎢                ⎥
-     *        C = ⎢sy_1  sy_2  sy_3⎥  x  ⎢ty_1  ty_2  ty_3⎥
-     *            ⎢                ⎥     ⎢                ⎥
-     *            ⎣  1     1     1 ⎦     ⎣  1     1     1 ⎦
-     *
-     */
-
-    Mat9 coeff_tmp, tmi, tm, ts, coeff;
-
-    const float xl = width /  (float)num_blocks;
-    const float xr = width /  (float)num_blocks * (num_blocks - 1);
-    const float yu = height / (float)num_blocks;
-    const float yl = height / (float)num_blocks * (num_blocks - 1);
-
-    /* skip LR */
-    tm.set(clicked_x[UL],   clicked_x[UR],  clicked_x[LL],
-           clicked_y[UL],   clicked_y[UR],  clicked_y[LL],
-           1,               1,              1);
-    ts.set(xl,              xr,             xl,
-           yu,              yu,             yl,
-           1,               1,              1);
-
-    mat9_invert(tm, tmi);
-    mat9_product(ts, tmi, coeff);
-
-    /* skip UL */
-    tm.set(clicked_x[LR],   clicked_x[UR],  clicked_x[LL],
-           clicked_y[LR],   clicked_y[UR],  clicked_y[LL],
-           1,               1,              1);
-    ts.set(xr,              xr,             xl,
-           yl,              yu,             yl,
-           1,               1,              1);
-
-    mat9_invert(tm, tmi);
-    mat9_product(ts, tmi, coeff_tmp);
-    mat9_sum(coeff_tmp, coeff);
-
-    /* skip UR */
-    tm.set(clicked_x[LR],   clicked_x[UL],  clicked_x[LL],
-           clicked_y[LR],   clicked_y[UL],  clicked_y[LL],
-           1,               1,              1);
-    ts.set(xr,              xl,             xl,
-           yl,              yu,             yl,
-           1,               1,              1);
-
-    mat9_invert(tm, tmi);
-    mat9_product(ts, tmi, coeff_tmp);
-    mat9_sum(coeff_tmp, coeff);
-
-    /* skip LL */
-    tm.set(clicked_x[LR],   clicked_x[UL],  clicked_x[UR],
-           clicked_y[LR],   clicked_y[UL],  clicked_y[UR],
-           1,               1,              1);
-    ts.set(xr,              xl,             xr,
-           yl,              yu,             yu,
-           1,               1,              1);
-
-    mat9_invert(tm, tmi);
-    mat9_product(ts, tmi, coeff_tmp);
-    mat9_sum(coeff_tmp, coeff);
-
-    /*
-     * the final matrix is the average of the previous computed ones
-     */
-    mat9_product(1.0/4.0, coeff);
-
-    /*
-     *             Coefficient normalization
-     *
-     * The matrix to pass to libinput has to be normalized; we need to
-     * translate and scale the coeffiecient so the matrix can operate in
-     * a space where the coordinates x and y (both in input and output) are
-     * in the range 0..1
-     *
-     * To do that, assume:
-     *
-     * a "translation" matrix is
-     *       [ 1 0 dx ]
-     * Tr =  [ 0 1 dy ]
-     *       [ 0 0 1  ]
-     *
-     * a "scale" matrix is
-     *       [ sx 0  0 ]
-     * Sc =  [ 0  sy 0 ]
-     *       [ 0  0  1 ]
-     *
-     * To change the coordinate from the normalizate space to the screen space
-     * - First we need to scale from (0..1 x 0..1) to (width x height); so
-     *   sx = maxx - minx + 1 = width, sy = maxy - miny + 1 = height
-     * - Second we need to translate
-     *   from (0..width-1 x 0..hight-1) to (minx..maxx x miny..maxy)
-     *   so dx = minx, dy = miny
-     *
-     * So
-     *    C = Tr x Sc x Cn x Sc^-1 x Tc^-1
-     * this means that
-     *    Cn = Sc^-1 x Tr^-1 x C x Tr x Sc
-     * where
-     *      C is the Calibration matrix in the "screen" spaces
-     *      Cn is the normalizated matrix that can be passed to libinput
-     *
-     * Because in the screen space usually minx=miny=0, this means
-     * that dx == dy == 0 -> T == T^-1 == identity. So we can write
-     *      Cn = Sc^-1 x C x Sc
-     *
-     *
-     * and because
-     *
-     *                ⎡a  b  c⎤
-     *                ⎢       ⎥
-     *        C   =   ⎢d  e  f⎥
-     *                ⎢       ⎥
-     *                ⎣0  0  1⎦
-     *
-     * then
-     *              ⎡      b⋅sy  c ⎤
-     *              ⎢ a    ────  ──⎥
-     *              ⎢       sx   sx⎥
-     *              ⎢              ⎥
-     *       Cn =   ⎢d⋅sx        f ⎥
-     *              ⎢────   e    ──⎥
-     *              ⎢ sy         sy⎥
-     *              ⎢              ⎥
-     *              ⎣ 0     0    1 ⎦
-     *
-     *
-     *
-     * See libinput function evdev_device_calibrate() (in src/evdev.c)
-     *
-     * As further reference, if dx/dy are not zero:
-     *
-     *              ⎡        b⋅sy            b⋅dy⋅sy   c      ⎤
-     *              ⎢ a      ────     a⋅dx + ─────── + ── - dx⎥
-     *              ⎢         sx                sx     sx     ⎥
-     *              ⎢                                         ⎥
-     *              ⎢d⋅sx             d⋅dx⋅sx               f ⎥
-     *       Cn =   ⎢────     e       ─────── + dy⋅e - dy + ──⎥
-     *              ⎢ sy                 sy                 sy⎥
-     *              ⎢                                         ⎥
-     *              ⎣ 0       0                  1            ⎦
-     */
-
-    coeff[1] *= (float)height/width;
-    coeff[2] *= 1.0/width;
-
-    coeff[3] *= (float)width/height;
-    coeff[5] *= 1.0/height;
-
-    /*
-     * Sometimes, the last row values are like -0.0, -0.0, 1
-     * update to the right values, otherwise libinput complaints !
-     */
-    coeff[6] = 0.0;
-    coeff[7] = 0.0;
-    coeff[8] = 1.0;
+    Mat3d coeff;
+    auto points = get_points(width, height);
+    if (!solver_calibrate(points, width, height,
+                          robust ? threshold_outlier() / 2.0 : 0, coeff)) {
+        fprintf(stderr, "ERROR: the touched points are degenerate\n");
+        return false;
+    }
+    solver_stats(points, mat9_denormalize(coeff, width, height), stats);
 
     /*
-     * The final matrix is the product of the current one and the computed one
+     * The final matrix is the product of the current one and the computed one;
+     * only the result is rounded to float, the type of the X property
      */
     Mat9 actual_matrix;
     getMatrix(matrix_name, actual_matrix);
-    mat9_product(actual_matrix, coeff, result_coeff);
+    result_coeff = Mat9(Mat3d(actual_matrix) * coeff);
 
     return true;
 }
 
 // Activate calibrated data and output it
-bool Calibrator::save_calibration()
+bool Calibrator::save_calibration(bool sync)
 {
-    auto success = set_calibration(result_coeff);
-
-    // close
-    XSync(display, False);
+    // the property write waits for the server, if 'sync'
+    auto success = set_calibration(result_coeff, sync);
     reset_data = false;
 
     return success;
 }
 
-bool Calibrator::set_calibration(const Mat9 &coeff) {
+bool Calibrator::apply_calibration(const Mat9 &coeff) {
+    // the property write waits for the server
+    auto success = set_calibration(coeff);
+    if (success)
+        reset_data = false;
+
+    return success;
+}
+
+bool Calibrator::set_calibration(const Mat9 &coeff, bool sync) {
     try {
-        setMatrix(matrix_name, coeff);
+        setMatrix(matrix_name, coeff, sync);
     } catch(...) {
         if (verbose)
             printf("Failed to apply axis calibration.\n");
@@ -339,16 +169,16 @@ bool Calibrator::set_calibration(const Mat9 &coeff) {
     return true;
 }
 
-bool Calibrator::add_click(int x, int y)
+bool Calibrator::add_click(double x, double y)
 {
     // Double-click detection
     if (threshold_doubleclick > 0 && get_numclicks() > 0) {
         int i = get_numclicks() - 1;
         while (i >= 0) {
-            if (abs(x - clicked_x[i]) <= threshold_doubleclick
-                && abs(y - clicked_y[i]) <= threshold_doubleclick) {
+            if (std::fabs(x - clicked_x[i]) <= threshold_doubleclick
+                && std::fabs(y - clicked_y[i]) <= threshold_doubleclick) {
                 if (verbose) {
-                    printf("WARNING: Not adding click %i (X=%i, Y=%i): within %i pixels of previous click\n",
+                    printf("WARNING: Not adding click %i (X=%.1f, Y=%.1f): within %i pixels of previous click\n",
                          get_numclicks(), x, y, threshold_doubleclick);
                 }
                 return false;
@@ -358,54 +188,9 @@ bool Calibrator::add_click(int x, int y)
     }
 
     // Mis-click detection
-    if (threshold_misclick > 0 && get_numclicks() > 0) {
-        bool misclick = true;
-
-        switch (get_numclicks()) {
-            case 1:
-                // check that along one axis of first point
-                if (along_axis(x,clicked_x[UL],clicked_y[UL]) ||
-                        along_axis(y,clicked_x[UL],clicked_y[UL]))
-                {
-                    misclick = false;
-                } else if (verbose) {
-                    printf("WARNING: Mis-click detected, click %i (X=%i, Y=%i) not aligned with click 0 (X=%i, Y=%i) (threshold=%i)\n",
-                            get_numclicks(), x, y, clicked_x[UL], clicked_y[UL], threshold_misclick);
-                }
-                break;
-
-            case 2:
-                // check that along other axis of first point than second point
-                if ((along_axis( y, clicked_x[UL], clicked_y[UL])
-                            && along_axis( clicked_x[UR], clicked_x[UL], clicked_y[UL]))
-                        || (along_axis( x, clicked_x[UL], clicked_y[UL])
-                            && along_axis( clicked_y[UR], clicked_x[UL], clicked_y[UL])))
-                {
-                    misclick = false;
-                } else if (verbose) {
-                    printf("WARNING: Mis-click detected, click %i (X=%i, Y=%i) not aligned with click 0 (X=%i, Y=%i) or click 1 (X=%i, Y=%i) (threshold=%i)\n",
-                            get_numclicks(), x, y, clicked_x[UL], clicked_y[UL], clicked_x[UR], clicked_y[UR], threshold_misclick);
-                }
-                break;
-
-            case 3:
-                // check that along both axis of second and third point
-                if ( ( along_axis( x, clicked_x[UR], clicked_y[UR])
-                            &&   along_axis( y, clicked_x[LL], clicked_y[LL]) )
-                        ||( along_axis( y, clicked_x[UR], clicked_y[UR])
-                            &&  along_axis( x, clicked_x[LL], clicked_y[LL]) ) )
-                {
-                    misclick = false;
-                } else if (verbose) {
-                    printf("WARNING: Mis-click detected, click %i (X=%i, Y=%i) not aligned with click 1 (X=%i, Y=%i) or click 2 (X=%i, Y=%i) (threshold=%i)\n",
-                            get_numclicks(), x, y, clicked_x[UR], clicked_y[UR], clicked_x[LL], clicked_y[LL], threshold_misclick);
-                }
-        }
-
-        if (misclick) {
-            reset();
-            return false;
-        }
+    if (!robust && threshold_misclick > 0 && !check_misclick(x, y)) {
+        reset();
+        return false;
     }
 
     clicked_x.push_back(x);
@@ -414,146 +199,86 @@ bool Calibrator::add_click(int x, int y)
     return true;
 }
 
-inline bool Calibrator::along_axis(int xy, int x0, int y0)
+std::vector<SolverPoint> Calibrator::get_points(int width, int height) const
 {
-    return ((abs(xy - x0) <= threshold_misclick) ||
-            (abs(xy - y0) <= threshold_misclick));
+    std::vector<SolverPoint> points;
+    for (int i = 0 ; i < get_numclicks() ; i++)
+        points.push_back({clicked_x[i], clicked_y[i],
+                          grid.x(i, width), grid.y(i, height)});
+    return points;
 }
 
-bool Calibrator::output_xinput(const std::string &output_filename)
+int Calibrator::find_outlier(int width, int height)
 {
+    if (get_numclicks() != grid.size())
+        return -1;
 
-    std::string devname;
-    if (device_name.size() == 0)
-        devname = std::to_string(device_id);
-    else
-        devname = device_name;
-
-    if(output_filename == "")
-        printf("Install the 'xinput' tool and copy the command(s) below in a script that starts with your X session\n");
-    else
-        printf("Writing calibration script to '%s'\n", output_filename.c_str());
-
-    // create startup script
-    char line[2000];
-    std::string outstr;
-
-    snprintf(line, sizeof(line)-1,
-                "\n       xinput set-float-prop \"%s\" \"%s"
-                "\" \\\n            %f %f %f %f %f \\\n            "
-                "%f %f %f %f\n\n",
-                devname.c_str(), matrix_name.c_str(),
-                result_coeff[0], result_coeff[1], result_coeff[2],
-                result_coeff[3], result_coeff[4], result_coeff[5],
-                result_coeff[6], result_coeff[7], result_coeff[8]
-                           );
-    outstr += line;
-
-    // console out
-    printf("%s", outstr.c_str());
-    // file out
-    if(output_filename != "") {
-        FILE* fid = fopen(output_filename.c_str(), "w");
-        if (fid == NULL) {
-            fprintf(stderr, "Error: Can't open '%s' for writing. Make sure you have the necessary rights\n", output_filename.c_str());
-            fprintf(stderr, "New calibration data NOT saved\n");
-            return false;
-        }
-        fprintf(fid, "%s", outstr.c_str());
-        fclose(fid);
+    int i = solver_find_outlier(get_points(width, height), threshold_outlier());
+    if (i >= 0 && verbose) {
+        printf("WARNING: click %i (X=%.1f, Y=%.1f) inconsistent with the others (threshold=%i)\n",
+                i, clicked_x[i], clicked_y[i], threshold_outlier());
     }
 
-    return true;
+    return i;
 }
 
-bool Calibrator::output_xorgconfd(const std::string &output_filename)
+bool Calibrator::replace_click(int i, double x, double y)
 {
+    if (i < 0 || i >= get_numclicks())
+        return false;
 
-    if(output_filename.size() == 0)
-        printf("Copy the snippet below into '/etc/X11/xorg.conf.d/99-calibration.conf' (/usr/share/X11/xorg.conf.d/ in some distro's)\n");
-    else
-        printf("Writing xorg.conf calibration data to '%s'\n", output_filename.c_str());
+    clicked_x[i] = x;
+    clicked_y[i] = y;
 
-    // xorg.conf.d snippet
-    char line[2000];
-    std::string outstr;
-    std::string devname;
-    if (device_name.size() == 0)
-        devname = std::to_string(device_id);
-    else
-        devname = device_name;
-
-    outstr += "\n";
-    outstr += "Section \"InputClass\"\n";
-    outstr += "\tIdentifier\t\"calibration\"\n";
-    sprintf(line, "\tMatchProduct\t\"%s\"\n", devname.c_str());
-    outstr += line;
-    snprintf(line, sizeof(line) - 1,
-                "\tOption\t\t\"CalibrationMatrix\"\t\"%f %f %f %f %f %f %f %f %f \"\n",
-                result_coeff[0], result_coeff[1], result_coeff[2], result_coeff[3], result_coeff[4], result_coeff[5],
-                result_coeff[6], result_coeff[7], result_coeff[8]);
-    outstr += line;
-    outstr += "EndSection\n\n";
-
-    // console out
-    printf("%s", outstr.c_str());
-
-    // file out
-    if(output_filename.size()) {
-        FILE* fid = fopen(output_filename.c_str(), "w");
-        if (fid == NULL) {
-            fprintf(stderr, "Error: Can't open '%s' for writing. Make sure you have the necessary rights\n", output_filename.c_str());
-            fprintf(stderr, "New calibration data NOT saved\n");
-            return false;
+    return true;
+}
+
+bool Calibrator::check_misclick(double x, double y)
+{
+    /*
+     * The targets on the same row (or column) share a coordinate; the
+     * touch axes may be swapped, so accept either x or y
+     */
+    const int n = get_numclicks();
+    for (int i = 0 ; i < n ; i++) {
+        if (!grid.aligned(i, n))
+            continue;
+        if (std::fabs(x - clicked_x[i]) <= threshold_misclick ||
+                std::fabs(y - clicked_y[i]) <= threshold_misclick)
+            continue;
+
+        if (verbose) {
+            printf("WARNING: Mis-click detected, click %i (X=%.1f, Y=%.1f) not aligned with click %i (X=%.1f, Y=%.1f) (threshold=%i)\n",
+                    n, x, y, i, clicked_x[i], clicked_y[i], threshold_misclick);
         }
-        fprintf(fid, "%s", outstr.c_str());
-        fclose(fid);
+        return false;
     }
 
     return true;
 }
 
-bool Calibrator::output_udev_libinput(const std::string &output_filename)
+std::string Calibrator::output_device_name() const
 {
-
     if (device_name.size() == 0)
-        fprintf(stderr, "WARNING: device_name is missing\n");
-
-    if(output_filename == "")
-        printf("Copy the command below in a script like /etc/udev/rules.d/touchscreen.rules\n");
-    else
-        printf("Writing calibration script to '%s'\n", output_filename.c_str());
-
-    // create startup script
-    char line[2000];
-    std::string outstr;
-
-    snprintf(line, sizeof(line)-1,
-            "SUBSYSTEM==\"input\", "
-                "KERNEL==\"event[0-9]*\", "
-                "ATTRS{name}==\"%s\", "
-                "ENV{LIBINPUT_CALIBRATION_MATRIX}=\"%f %f %f %f %f %f\"\n",
-            device_name.c_str(),
-            result_coeff[0], result_coeff[1], result_coeff[2],
-            result_coeff[3], result_coeff[4], result_coeff[5]
-    );
-    outstr += line;
-
-    // console out
-    printf("%s", outstr.c_str());
-    // file out
-    if(output_filename != "") {
-        FILE* fid = fopen(output_filename.c_str(), "w");
-        if (fid == NULL) {
-            fprintf(stderr, "Error: Can't open '%s' for writing. Make sure you have the necessary rights\n", output_filename.c_str());
-            fprintf(stderr, "New calibration data NOT saved\n");
-            return false;
-        }
-        fprintf(fid, "%s", outstr.c_str());
-        fclose(fid);
-    }
+        return std::to_string(device_id);
+    return device_name;
+}
 
-    return true;
+bool Calibrator::output_xinput(const std::string &output_filename)
+{
+    return ::output_xinput(output_device_name(), matrix_name, result_coeff,
+                           output_filename);
+}
+
+bool Calibrator::output_xorgconfd(const std::string &output_filename)
+{
+    return ::output_xorgconfd(output_device_name(), result_coeff,
+                              output_filename);
+}
+
+bool Calibrator::output_udev_libinput(const std::string &output_filename)
+{
+    return ::output_udev_libinput(device_name, result_coeff, output_filename);
 }
 
 Calibrator::~Calibrator() {
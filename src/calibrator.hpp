@@ -25,12 +25,15 @@
 
 #include <X11/extensions/XInput.h>
 #include <cassert>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <utility>
 
 #include "xinput.hpp"
 #include "mat9.hpp"
+#include "grid.hpp"
+#include "solver.hpp"
 
 class WrongCalibratorException : public std::invalid_argument {
     public:
@@ -47,17 +50,22 @@ private:
     Mat9        old_coeff;
     bool        reset_data;
     XInputTouch *xinputtouch = nullptr;
+    std::unique_ptr<XInputTouch> own_xinputtouch;
     std::string matrix_name;
 
 
 public:
+    /// outlier threshold (pixels) of the robust mode, without --threshold-misclick
+    static constexpr int default_threshold_outlier = 30;
+
     Calibrator( Display *display,
                     const std::string &device_name,
                     XID device_id,
                     const int thr_misclick,
                     const int thr_doubleclick,
                     std::string matrix_name_,
-                    bool verbose);
+                    bool verbose,
+                    XInputTouch *xinputtouch_ = nullptr);
 
     ~Calibrator();
 
@@ -65,7 +73,9 @@ public:
     bool finish(int width, int height);
 
 
-    bool set_calibration(const Mat9 &coeff);
+    bool set_calibration(const Mat9 &coeff, bool sync = true);
+    /// set the calibration and keep it when the Calibrator goes away
+    bool apply_calibration(const Mat9 &coeff);
 
     /// set the doubleclick treshold
     void set_threshold_doubleclick(int t)
@@ -75,6 +85,14 @@ public:
     void set_threshold_misclick(int t)
     { threshold_misclick = t; }
 
+    /// keep the clicks and drop/re-ask the inconsistent ones
+    void set_robust(bool r)
+    { robust = r; }
+
+    /// set the layout of the targets
+    void set_grid(const CalibrationGrid &g)
+    { grid = g; }
+
     /// get the number of clicks already registered
     int get_numclicks() const
     { return clicked_x.size(); }
@@ -83,27 +101,37 @@ public:
     void reset()
     {  clicked_x.clear(); clicked_y.clear();}
 
-    std::pair<int, int> get_point(int i) {
+    std::pair<double, double> get_point(int i) {
         return std::pair{clicked_x[i], clicked_y[i]};
     }
 
     /// add a click with the given coordinates
-    bool add_click(int x, int y);
+    bool add_click(double x, double y);
+
+    /// robust mode: return the click to redo, or -1 if all are consistent
+    int find_outlier(int width, int height);
 
-    bool save_calibration();
+    /// robust mode: replace the click 'i'
+    bool replace_click(int i, double x, double y);
+
+    /// apply the result of finish(); without 'sync' the caller has to XSync()
+    bool save_calibration(bool sync = true);
     bool output_xinput(const std::string &nf = "");
     bool output_xorgconfd(const std::string &nf = "");
     bool output_udev_libinput(const std::string &nf = "");
 
     Mat9 get_coeff() { return result_coeff; }
+    const std::string &get_device_name() const { return device_name; }
+    /// accuracy of the last calibration computed by finish()
+    const CalibrationStats &get_stats() const { return stats; }
     void set_identity();
 
 private:
 
-    /// check whether the coordinates are along the respective axis
-    bool along_axis(int xy, int x0, int y0);
+    /// check whether the click is aligned with the previous ones
+    bool check_misclick(double x, double y);
 
-    std::vector<int> clicked_x, clicked_y;
+    std::vector<double> clicked_x, clicked_y;
 
     // Threshold to keep the same point from being clicked twice.
     // Set to zero if you don't want this check
@@ -114,14 +142,28 @@ private:
     // Set to zero if you don't want this check
     int threshold_misclick = 0;
 
+    // In robust mode the clicks are not checked one by one: the
+    // inconsistent ones are found at the end, and the fit down-weights
+    // the residual outliers
+    bool robust = false;
+    int threshold_outlier() const
+    { return threshold_misclick > 0 ? threshold_misclick : default_threshold_outlier; }
+
+    std::vector<SolverPoint> get_points(int width, int height) const;
+
+    /// the device name, or its id if the name is not known
+    std::string output_device_name() const;
+
     std::string device_name;
 
     bool verbose = false;
 
-    const int num_blocks = 8;
+    CalibrationGrid grid;
 
     Mat9 result_coeff;
+    CalibrationStats stats;
 
-    void setMatrix(const std::string &name, const Mat9 &coeff);
+    void setMatrix(const std::string &name, const Mat9 &coeff,
+                   bool sync = true);
     void getMatrix(const std::string &name, Mat9 &coeff);
 };
@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2024 Goffredo Baroncelli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <X11/Xlib.h>
+#include <X11/extensions/XInput2.h>
+
+#include <cstdio>
+
+#include "daemon.hpp"
+#include "calibrator.hpp"
+#include "reactor.hpp"
+
+/*
+ * A device can go away between its hotplug event and our requests: the
+ * error is recorded, and the request is treated as done on a removed device
+ */
+static int daemon_x_error = 0;
+
+static int daemon_error_handler(Display *display, XErrorEvent *ev) {
+    daemon_x_error = ev->error_code;
+    return 0;
+}
+
+CalibrationDaemon::CalibrationDaemon(Display *display_,
+                                     XInputTouch &xinputtouch_,
+                                     const std::string &device_name_,
+                                     const std::string &matrix_name_,
+                                     const Mat9 &coeff_, bool verbose_,
+                                     WatchMode watch_)
+    : display(display_), xinputtouch(xinputtouch_), device_name(device_name_),
+      matrix_name(matrix_name_), coeff(coeff_), verbose(verbose_),
+      watch(watch_)
+{
+}
+
+bool CalibrationDaemon::matches(XID id) {
+    if (device_name != "") {
+        auto dev = xinputtouch.snapshot()->find(id);
+        return dev && dev->name == device_name;
+    }
+
+    std::vector<XInputTouch::XDevInfo> ret;
+    return xinputtouch.find_touch(ret) == 1 && ret[0].id == id;
+}
+
+bool CalibrationDaemon::device_gone(XID id) {
+    if (!daemon_x_error)
+        return false;
+
+    printf("WARNING: device %lu is gone (X error %d)\n", id, daemon_x_error);
+    fflush(stdout);
+    daemon_x_error = 0;
+    return true;
+}
+
+bool CalibrationDaemon::apply(XID id) {
+    auto dev = xinputtouch.snapshot()->find(id);
+    if (!dev)
+        return false;
+
+    daemon_x_error = 0;
+    std::string mname = matrix_name;
+    int ret = xinputtouch.resolve_matrix(id, mname);
+    if (device_gone(id))
+        return false;
+    if (ret < 0) {
+        fprintf(stderr, "WARNING: device %lu ('%s') doesn't have a suitable calibration matrix\n",
+                id, dev->name.c_str());
+        return false;
+    }
+
+    try {
+        Calibrator calib(display, dev->name, id, 0, 0, mname, false,
+                         &xinputtouch);
+        if (!calib.apply_calibration(coeff) || daemon_x_error) {
+            if (device_gone(id))
+                return false;
+            fprintf(stderr, "WARNING: unable to apply the calibration to device %lu ('%s')\n",
+                    id, dev->name.c_str());
+            return false;
+        }
+    } catch (const WrongCalibratorException &e) {
+        if (!device_gone(id))
+            fprintf(stderr, "WARNING: %s\n", e.what());
+        return false;
+    }
+    if (device_gone(id))
+        return false;
+
+    if (verbose)
+        printf("Calibration applied to device %lu ('%s')\n", id,
+               dev->name.c_str());
+
+    if (watch != WATCH_NONE && id != watched_id) {
+        watched_id = id;
+        watched_matrix_name = mname;
+        watched_matrix = XAtoms::get(display).intern(mname);
+        select_events();
+    }
+
+    return true;
+}
+
+void CalibrationDaemon::on_xevent() {
+    while (XPending(display)) {
+        XEvent ev;
+        XNextEvent(display, &ev);
+
+        auto cookie = &ev.xcookie;
+        if (cookie->type != GenericEvent || cookie->extension != xi_opcode)
+            continue;
+        if (!XGetEventData(display, cookie))
+            continue;
+        if (cookie->evtype == XI_HierarchyChanged)
+            on_hierarchy_event(cookie);
+        else if (cookie->evtype == XI_PropertyEvent)
+            on_property_event(cookie);
+        XFreeEventData(display, cookie);
+    }
+}
+
+void CalibrationDaemon::select_events() {
+    unsigned char hmask[XIMaskLen(XI_LASTEVENT)] = { 0 };
+    unsigned char pmask[XIMaskLen(XI_LASTEVENT)] = { 0 };
+    XIEventMask evmasks[2];
+    int n = 0;
+
+    evmasks[n].deviceid = XIAllDevices;
+    evmasks[n].mask_len = sizeof(hmask);
+    evmasks[n].mask = hmask;
+    XISetMask(hmask, XI_HierarchyChanged);
+    n++;
+
+    if (watched_id != (XID)-1) {
+        evmasks[n].deviceid = watched_id;
+        evmasks[n].mask_len = sizeof(pmask);
+        evmasks[n].mask = pmask;
+        XISetMask(pmask, XI_PropertyEvent);
+        n++;
+    }
+
+    XISelectEvents(display, DefaultRootWindow(display), evmasks, n);
+    XFlush(display);
+}
+
+void CalibrationDaemon::on_property_event(XGenericEventCookie *cookie) {
+    auto ev = (XIPropertyEvent *)cookie->data;
+
+    if ((XID)ev->deviceid != watched_id || ev->property != watched_matrix)
+        return;
+
+    Mat9 current;
+    XPropData value;
+    daemon_x_error = 0;
+    bool ok = ev->what != XIPropertyDeleted &&
+              xinputtouch.get_prop(watched_id, watched_matrix_name.c_str(),
+                                   value) == 0 &&
+              value.type == XAtoms::get(display).float_atom &&
+              value.size() == 9;
+    if (device_gone(watched_id))
+        return;
+    if (ok) {
+        for (int i = 0 ; i < 9 ; i++)
+            current[i] = value.get_float(i);
+        // our own update
+        if (current.almost_equal(coeff, watch_epsilon))
+            return;
+    }
+
+    if (ok) {
+        printf("WARNING: the calibration matrix of device %lu was changed to:\n",
+               watched_id);
+        mat9_print(current);
+    } else {
+        printf("WARNING: the calibration matrix of device %lu was removed\n",
+               watched_id);
+    }
+    fflush(stdout);
+
+    if (watch == WATCH_REVERT && ok)
+        apply(watched_id);
+}
+
+void CalibrationDaemon::on_hierarchy_event(XGenericEventCookie *cookie) {
+    auto ev = (XIHierarchyEvent *)cookie->data;
+
+    if (!(ev->flags & (XISlaveAdded | XISlaveRemoved | XIDeviceEnabled)))
+        return;
+
+    // the devices changed, enumerate them again
+    xinputtouch.invalidate();
+
+    for (int i = 0 ; i < ev->num_info ; i++)
+        if ((ev->info[i].flags & XISlaveRemoved) &&
+                (XID)ev->info[i].deviceid == watched_id)
+            watched_id = (XID)-1;
+
+    for (int i = 0 ; i < ev->num_info ; i++) {
+        if (!(ev->info[i].flags & XIDeviceEnabled))
+            continue;
+        if (matches(ev->info[i].deviceid))
+            apply(ev->info[i].deviceid);
+    }
+}
+
+int CalibrationDaemon::run() {
+    int event, error;
+    if (!XQueryExtension(display, "XInputExtension", &xi_opcode, &event,
+                         &error)) {
+        fprintf(stderr, "ERROR: XInput extension not available\n");
+        return 1;
+    }
+
+    // only 2.0 is needed, but the version has to match the other users
+    int major = XI2_MAJOR, minor = XI2_MINOR;
+    if (XIQueryVersion(display, &major, &minor) != Success || major < 2) {
+        fprintf(stderr, "ERROR: XInput 2.0 not available\n");
+        return 1;
+    }
+
+    // the default handler exit()s on a BadDevice
+    XSync(display, False);
+    auto old_handler = XSetErrorHandler(daemon_error_handler);
+
+    select_events();
+
+    // the device may be already there
+    for (auto &dev : xinputtouch.snapshot()->devices())
+        if (matches(dev.id))
+            apply(dev.id);
+
+    if (verbose)
+        printf("Waiting for the devices hotplug\n");
+
+    Reactor reactor;
+    reactor.add_fd(ConnectionNumber(display), [&](){ on_xevent(); });
+    reactor.set_prepare([&](){
+        // Xlib may have read events that epoll doesn't see anymore
+        if (XEventsQueued(display, QueuedAlready))
+            on_xevent();
+        XFlush(display);
+    });
+    for (int signum : {SIGINT, SIGTERM}) {
+        reactor.add_signal(signum, [&](int){
+            if (verbose)
+                printf("Exiting\n");
+            reactor.stop();
+        });
+    }
+
+    bool ok = reactor.run();
+    XSetErrorHandler(old_handler);
+
+    return ok ? 0 : 1;
+}
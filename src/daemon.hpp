@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2024 Goffredo Baroncelli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <X11/Xlib.h>
+
+#include <string>
+
+#include "xinput.hpp"
+#include "mat9.hpp"
+
+/*
+ * Long running mode: keep the calibration matrix of a device applied.
+ * It listens for the XI2 hierarchy events, and when the device comes
+ * back (e.g. after an USB reset) it applies the matrix again.
+ * Optionally it watches the matrix property too, and logs or reverts
+ * the changes made by other clients.
+ */
+class CalibrationDaemon {
+public:
+    enum WatchMode { WATCH_NONE, WATCH_LOG, WATCH_REVERT };
+
+    /// max difference between a coefficient and the expected one
+    static constexpr float watch_epsilon = 1e-5;
+
+    /*
+     * The device is matched by name; when 'device_name' is empty the
+     * default touch (see XInputTouch::find_touch()) is used.
+     */
+    CalibrationDaemon(Display *display, XInputTouch &xinputtouch,
+                      const std::string &device_name,
+                      const std::string &matrix_name,
+                      const Mat9 &coeff, bool verbose,
+                      WatchMode watch = WATCH_NONE);
+
+    /*
+     * apply the matrix, then wait for the hotplug events; returns on error,
+     * or 0 on SIGINT/SIGTERM
+     */
+    int run();
+
+private:
+    Display     *display;
+    XInputTouch &xinputtouch;
+    std::string device_name;
+    std::string matrix_name;
+    Mat9        coeff;
+    bool        verbose;
+    WatchMode   watch;
+    int         xi_opcode = -1;
+
+    // the device and the matrix currently watched
+    XID         watched_id = (XID)-1;
+    Atom        watched_matrix = None;
+    std::string watched_matrix_name;
+
+    bool matches(XID id);
+    /// log and forget an X error on 'id' (e.g. it was just unplugged)
+    bool device_gone(XID id);
+    bool apply(XID id);
+    void select_events();
+    void on_xevent();
+    void on_hierarchy_event(XGenericEventCookie *cookie);
+    void on_property_event(XGenericEventCookie *cookie);
+};
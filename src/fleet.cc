@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2024 Goffredo Baroncelli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <X11/Xlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "fleet.hpp"
+#include "calibrator.hpp"
+#include "xinput.hpp"
+
+/* the X errors are reported to the thread that made the request */
+static thread_local int last_x_error = 0;
+
+static int fleet_error_handler(Display *display, XErrorEvent *ev) {
+    last_x_error = ev->error_code;
+    return 0;
+}
+
+/*
+ * A broken connection (e.g. the X server went away) fails only the job of
+ * its display: the other workers go on, and the summary is printed
+ */
+static thread_local bool x_io_error = false;
+
+#ifdef HAVE_XSETIOERROREXITHANDLER
+static void fleet_io_error_exit_handler(Display *display, void *data) {
+    // returning leaves the display unusable, but the process alive
+    x_io_error = true;
+}
+#else
+// before libX11 1.7 the handler can't return: the worker is parked
+static thread_local FleetResult *current_result = nullptr;
+static thread_local bool *current_parked = nullptr;
+static std::mutex done_lock;
+static std::condition_variable done_cond;
+static size_t nr_done = 0;
+
+static int fleet_io_error_handler(Display *display) {
+    current_result->ok = false;
+    current_result->error = "connection lost";
+    {
+        std::lock_guard<std::mutex> guard(done_lock);
+        *current_parked = true;
+        nr_done++;
+    }
+    done_cond.notify_all();
+    for (;;)
+        pause();
+    return 0;
+}
+#endif
+
+bool read_fleet_file(const std::string &filename, std::vector<FleetJob> &jobs)
+{
+    FILE *f = fopen(filename.c_str(), "r");
+    if (!f) {
+        fprintf(stderr, "ERROR: Can't open '%s'\n", filename.c_str());
+        return false;
+    }
+
+    char line[2000];
+    int lineno = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        line[strcspn(line, "\r\n")] = 0;
+
+        char *p = line + strspn(line, " \t");
+        if (*p == 0 || *p == '#')
+            continue;
+
+        FleetJob job;
+        auto end = p + strcspn(p, " \t");
+        job.display.assign(p, end);
+
+        p = end + strspn(end, " \t");
+        end = p + strcspn(p, " \t");
+        std::string matrix(p, end);
+        if (!mat9_parse(matrix.c_str(), job.coeff)) {
+            fprintf(stderr, "ERROR: %s:%d: wrong matrix\n", filename.c_str(),
+                    lineno);
+            ok = false;
+            continue;
+        }
+
+        p = end + strspn(end, " \t");
+        job.device_name = p;
+
+        jobs.push_back(job);
+    }
+
+    fclose(f);
+    return ok;
+}
+
+static FleetResult run_job(const FleetJob &job,
+                           const std::string &default_device_name,
+                           const std::string &default_matrix_name,
+                           bool verbose)
+{
+    FleetResult res;
+    auto start = std::chrono::steady_clock::now();
+
+    last_x_error = 0;
+    x_io_error = false;
+    Display *display = XOpenDisplay(job.display.c_str());
+    if (!display) {
+        res.error = "can't open display";
+        return res;
+    }
+#ifdef HAVE_XSETIOERROREXITHANDLER
+    XSetIOErrorExitHandler(display, fleet_io_error_exit_handler, nullptr);
+#endif
+
+    {
+        XInputTouch xinputtouch(display);
+        XID device_id = (XID)-1;
+        std::string device_name = job.device_name;
+        std::string matrix_name = default_matrix_name;
+        std::vector<XInputTouch::XDevInfo> candidates;
+
+        if (device_name == "")
+            device_name = default_device_name;
+
+        if (xinputtouch.resolve_device(device_id, device_name,
+                                       candidates) < 0) {
+            res.error = "unable to find the device";
+        } else if (xinputtouch.resolve_matrix(device_id, matrix_name) < 0) {
+            res.error = "unable to find a suitable calibration matrix";
+        } else {
+            try {
+                Calibrator calib(display, device_name, device_id, 0, 0,
+                                 matrix_name, verbose, &xinputtouch);
+                res.ok = calib.apply_calibration(job.coeff);
+                if (!res.ok)
+                    res.error = "unable to apply the calibration";
+            } catch (const WrongCalibratorException &e) {
+                res.error = e.what();
+            }
+        }
+    }
+
+    if (x_io_error) {
+        res.ok = false;
+        res.error = "connection lost";
+    } else if (res.ok && last_x_error) {
+        res.ok = false;
+        res.error = "X error " + std::to_string(last_x_error);
+    }
+
+    XAtoms::release(display);
+    XCloseDisplay(display);
+
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    res.msec = elapsed.count();
+
+    return res;
+}
+
+int run_fleet(const std::vector<FleetJob> &jobs,
+              const std::string &device_name,
+              const std::string &matrix_name,
+              int nr_workers, bool verbose)
+{
+    std::vector<FleetResult> results(jobs.size());
+    std::atomic<size_t> next(0);
+
+    if (nr_workers <= 0)
+        nr_workers = std::thread::hardware_concurrency();
+    if (nr_workers <= 0)
+        nr_workers = 1;
+    if ((size_t)nr_workers > jobs.size())
+        nr_workers = jobs.size();
+
+    XInitThreads();
+    auto old_handler = XSetErrorHandler(fleet_error_handler);
+#ifndef HAVE_XSETIOERROREXITHANDLER
+    auto old_io_handler = XSetIOErrorHandler(fleet_io_error_handler);
+    std::unique_ptr<bool[]> parked(new bool[nr_workers]());
+    nr_done = 0;
+#endif
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (int i = 0 ; i < nr_workers ; i++) {
+        workers.emplace_back([&, i]() {
+#ifndef HAVE_XSETIOERROREXITHANDLER
+            current_parked = &parked[i];
+#endif
+            for (;;) {
+                auto idx = next++;
+                if (idx >= jobs.size())
+                    break;
+#ifdef HAVE_XSETIOERROREXITHANDLER
+                results[idx] = run_job(jobs[idx], device_name, matrix_name,
+                                       verbose);
+#else
+                current_result = &results[idx];
+                auto res = run_job(jobs[idx], device_name, matrix_name,
+                                   verbose);
+                std::lock_guard<std::mutex> guard(done_lock);
+                results[idx] = res;
+                nr_done++;
+                done_cond.notify_all();
+#endif
+            }
+        });
+    }
+#ifdef HAVE_XSETIOERROREXITHANDLER
+    for (auto &w : workers)
+        w.join();
+#else
+    {
+        std::unique_lock<std::mutex> guard(done_lock);
+        done_cond.wait(guard, [&](){ return nr_done == jobs.size(); });
+    }
+    // the parked workers never end; they go away with the process
+    for (int i = 0 ; i < nr_workers ; i++) {
+        if (parked[i])
+            workers[i].detach();
+        else
+            workers[i].join();
+    }
+    XSetIOErrorHandler(old_io_handler);
+#endif
+
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    XSetErrorHandler(old_handler);
+
+    int failed = 0;
+    printf("%-20s %-8s %10s\n", "DISPLAY", "RESULT", "TIME(ms)");
+    for (auto i = 0u ; i < jobs.size() ; i++) {
+        auto &r = results[i];
+        printf("%-20s %-8s %10.1f", jobs[i].display.c_str(),
+               r.ok ? "OK" : "FAILED", r.msec);
+        if (!r.ok) {
+            printf("  %s", r.error.c_str());
+            failed++;
+        }
+        printf("\n");
+    }
+    printf("%zu displays, %d failed, %d workers, %.1f ms\n",
+           jobs.size(), failed, nr_workers, elapsed.count());
+
+    return failed ? 1 : 0;
+}
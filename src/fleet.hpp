@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2024 Goffredo Baroncelli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "mat9.hpp"
+
+/*
+ * Apply calibration matrices to many X displays at the same time. Each
+ * job runs in a worker thread that owns its Display, XInputTouch and
+ * Calibrator.
+ */
+struct FleetJob {
+    std::string display;
+    Mat9        coeff;
+    /// empty: use the default device
+    std::string device_name;
+};
+
+struct FleetResult {
+    bool        ok = false;
+    double      msec = 0;
+    std::string error;
+};
+
+/*
+ * Read a list of jobs, one per line: "<display> <x1,x2..x9> [device name]".
+ * Empty lines and lines starting with '#' are skipped.
+ */
+bool read_fleet_file(const std::string &filename, std::vector<FleetJob> &jobs);
+
+/// run the jobs with 'nr_workers' threads, and print a summary
+int run_fleet(const std::vector<FleetJob> &jobs,
+              const std::string &device_name,
+              const std::string &matrix_name,
+              int nr_workers, bool verbose);
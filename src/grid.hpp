@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2024 Goffredo Baroncelli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstdio>
+
+/*
+ * Geometry of the calibration targets. The screen is covered by a grid of
+ * 'cols' x 'rows' targets; the outer targets are 'inset' (as fraction of
+ * the width/height) away from the screen border, the inner ones are evenly
+ * spaced. The default is the historical layout: the screen is partitioned
+ * in 8 x 8 blocks and the user presses the points marked with 'O':
+ *
+ *   +--+--+--+--+--+--+--+--+
+ *   |  |  |  |  |  |  |  |  |
+ *   +--O--+--+--+--+--+--O--+
+ *   |  |  |  |  |  |  |  |  |
+ *   +--+--+--+--+--+--+--+--+
+ *   |  |  |  |  |  |  |  |  |
+ *   +--+--+--+--+--+--+--+--+
+ *   |  |  |  |  |  |  |  |  |
+ *   +--+--+--+--+--+--+--+--+
+ *   |  |  |  |  |  |  |  |  |
+ *   +--+--+--+--+--+--+--+--+
+ *   |  |  |  |  |  |  |  |  |
+ *   +--+--+--+--+--+--+--+--+
+ *   |  |  |  |  |  |  |  |  |
+ *   +--O--+--+--+--+--+--O--+
+ *   |  |  |  |  |  |  |  |  |
+ *   +--+--+--+--+--+--+--+--+
+ *
+ * With --grid=3x3 --grid-inset=0.05 the targets are:
+ *
+ *   +-------------------------+
+ *   | O          O          O |
+ *   |                         |
+ *   |                         |
+ *   | O          O          O |
+ *   |                         |
+ *   |                         |
+ *   | O          O          O |
+ *   +-------------------------+
+ *
+ * The targets are numbered row by row, from the upper-left one; so the
+ * default order is upper-left, upper-right, lower-left, lower-right.
+ */
+struct CalibrationGrid {
+    int cols = 2;
+    int rows = 2;
+    double inset = 1.0 / 8;
+
+    /// number of targets
+    int size() const { return cols * rows; }
+
+    int col(int i) const { return i % cols; }
+    int row(int i) const { return i / cols; }
+
+    /// position of the target 'i' on a screen of size width x height
+    double x(int i, int width) const {
+        return width * (inset + (1 - 2 * inset) * col(i) / (cols - 1));
+    }
+    double y(int i, int height) const {
+        return height * (inset + (1 - 2 * inset) * row(i) / (rows - 1));
+    }
+
+    /// true if the targets 'i' and 'j' are on the same row or column
+    bool aligned(int i, int j) const {
+        return col(i) == col(j) || row(i) == row(j);
+    }
+
+    /// parse a "<cols>x<rows>" string; return false on error
+    bool parse(const char *s) {
+        int c, r;
+        char tail;
+        if (sscanf(s, "%dx%d%c", &c, &r, &tail) != 2)
+            return false;
+        cols = c;
+        rows = r;
+        return true;
+    }
+
+    /// check the values; return false on error
+    bool valid() const {
+        return cols >= 2 && rows >= 2 && inset >= 0 && inset < 0.5;
+    }
+};
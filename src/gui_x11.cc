@@ -27,6 +27,7 @@
 #include <X11/Xos.h> // strncpy, strlen
 
 #include <X11/extensions/Xrandr.h>
+#include <X11/extensions/XInput2.h>
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -38,17 +39,9 @@
 #include <cassert>
 
 #include "gui_x11.hpp"
+#include "xinput.hpp"
 
 
-/// Names of the points
-enum {
-    UL = 0, // Upper-left
-    UR = 1, // Upper-right
-    LL = 2, // Lower-left
-    LR = 3,  // Lower-right
-    NUM_POINTS
-};
-
 // Timeout parameters
 static const int time_step = 100;  // in milliseconds
 static const int max_time = 15000; // 5000 = 5 sec
@@ -73,8 +66,10 @@ static const std::string help_text[help_lines] = {
 
 static const char* colors[nr_colors] = {"BLACK", "WHITE", "GRAY", "DIMGRAY", "RED"};
 
-GuiCalibratorX11::GuiCalibratorX11(Display *display_, int mnr)
-  : time_elapsed(0), points_count(0), monitor_nr(mnr), display(display_)
+GuiCalibratorX11::GuiCalibratorX11(Display *display_, int mnr,
+                                   const CalibrationGrid &grid_)
+  : grid(grid_), time_elapsed(0), points_count(0), monitor_nr(mnr),
+    display(display_)
 {
     screen_num = DefaultScreen(display);
     // Load font and get font information structure
@@ -87,6 +82,17 @@ GuiCalibratorX11::GuiCalibratorX11(Display *display_, int mnr)
         }
     }
 
+    // follow the monitors hotplug and rotation
+    int rr_error_base;
+    if (XRRQueryExtension(display, &rr_event_base, &rr_error_base)) {
+        XRRSelectInput(display, RootWindow(display, screen_num),
+                       RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask |
+                       RROutputChangeNotifyMask);
+    } else {
+        rr_event_base = 0;
+    }
+    update_monitors();
+
     int x, y, w, h;
     get_monitor_size(x, y, w, h, monitor_nr);
     set_window_size(x, y, w, h);
@@ -95,7 +101,8 @@ GuiCalibratorX11::GuiCalibratorX11(Display *display_, int mnr)
     // Register events on the window
     XSetWindowAttributes attributes;
     attributes.override_redirect = True;
-    attributes.event_mask = ExposureMask | KeyPressMask | ButtonPressMask;
+    attributes.event_mask = ExposureMask | KeyPressMask | ButtonPressMask |
+                            ButtonReleaseMask | ButtonMotionMask;
 
     win = XCreateWindow(display, RootWindow(display, screen_num),
                 window_x, window_y, window_width, window_height, 0,
@@ -107,7 +114,8 @@ GuiCalibratorX11::GuiCalibratorX11(Display *display_, int mnr)
     // Listen to events
     XGrabKeyboard(display, win, False, GrabModeAsync, GrabModeAsync,
                 CurrentTime);
-    XGrabPointer(display, win, False, ButtonPressMask, GrabModeAsync,
+    XGrabPointer(display, win, False,
+                ButtonPressMask | ButtonReleaseMask | ButtonMotionMask, GrabModeAsync,
                 GrabModeAsync, None, None, CurrentTime);
 
     Colormap colormap = DefaultColormap(display, screen_num);
@@ -117,40 +125,62 @@ GuiCalibratorX11::GuiCalibratorX11(Display *display_, int mnr)
         XAllocColor(display, colormap, &color);
         pixel[i] = color.pixel;
     }
-    XSetWindowBackground(display, win, pixel[GRAY]);
-    XClearWindow(display, win);
+    // the window is painted only from the buffer: no background to clear
+    XSetWindowBackgroundPixmap(display, win, None);
 
     gc = XCreateGC(display, win, 0, NULL);
+    // no NoExpose event back for each XCopyArea() of flush()
+    XSetGraphicsExposures(display, gc, False);
     XSetFont(display, gc, font_info->fid);
 
-}
+    buffer = XCreatePixmap(display, win, window_width, window_height,
+                           DefaultDepth(display, screen_num));
+    redraw();
 
-void  GuiCalibratorX11::get_overall_display_size( int &width, int &height) {
-    width = DisplayWidth(display, screen_num);
-    height = DisplayHeight(display, screen_num);
 }
 
-void GuiCalibratorX11::get_monitor_size(int &x, int &y, int &w, int &h,
-                                        int monitor_num) {
+void GuiCalibratorX11::update_monitors() {
+    screen_width = DisplayWidth(display, screen_num);
+    screen_height = DisplayHeight(display, screen_num);
 
     int n;
     auto root = RootWindow (display, screen_num);
-    auto monitors = XRRGetMonitors(display, root, false, &n);
+    auto mi = XRRGetMonitors(display, root, false, &n);
 
-    if (n == -1) {
+    monitors.clear();
+    monitors_valid = n != -1;
+    if (!monitors_valid) {
         fprintf(stderr, "WARNING: cannot execute XRRGetMonitors\n");
+        return;
+    }
+
+    for (int i = 0 ; i < n ; i++)
+        monitors.push_back({mi[i].x, mi[i].y, mi[i].width, mi[i].height});
+    XRRFreeMonitors(mi);
+}
+
+void  GuiCalibratorX11::get_overall_display_size( int &width, int &height) {
+    width = screen_width;
+    height = screen_height;
+}
+
+void GuiCalibratorX11::get_monitor_size(int &x, int &y, int &w, int &h,
+                                        int monitor_num) {
+
+    if (!monitors_valid) {
         x = y = 0;
-        w = DisplayWidth(display, screen_num);
-        h = DisplayHeight(display, screen_num);
+        w = screen_width;
+        h = screen_height;
         return;
     }
 
+    const int n = monitors.size();
     if (monitor_num >= n || monitor_num < 0 || monitor_num == -1) {
         x = y = w = h = 0;
 
-        for (int i = 0 ; i < n ; i++) {
-            int width = monitors[i].x + monitors[i].width;
-            int height = monitors[i].y + monitors[i].height;
+        for (auto &m : monitors) {
+            int width = m.x + m.width;
+            int height = m.y + m.height;
             if (width > w)
                 w = width;
             if (height > h)
@@ -163,18 +193,63 @@ void GuiCalibratorX11::get_monitor_size(int &x, int &y, int &w, int &h,
         w = monitors[monitor_num].width;
         h = monitors[monitor_num].height;
     }
-
-    XRRFreeMonitors(monitors);
-
 }
 
 GuiCalibratorX11::~GuiCalibratorX11()
 {
     XUngrabPointer(display, CurrentTime);
     XUngrabKeyboard(display, CurrentTime);
+    XFreePixmap(display, buffer);
     XFreeGC(display, gc);
 }
 
+void GuiCalibratorX11::set_monitor(int mnr)
+{
+    int x, y, w, h;
+    get_monitor_size(x, y, w, h, mnr);
+    monitor_nr = mnr;
+    move_window(x, y, w, h);
+    xi2_device_id = 0;
+    redraw();
+}
+// Move the window and restart the calibration
+void GuiCalibratorX11::move_window(int x, int y, int w, int h)
+{
+    if (w != window_width || h != window_height) {
+        XFreePixmap(display, buffer);
+        buffer = XCreatePixmap(display, win, w, h,
+                               DefaultDepth(display, screen_num));
+    }
+    XMoveResizeWindow(display, win, x, y, w, h);
+    set_window_size(x, y, w, h);
+
+    time_elapsed = 0;
+    nr_retaps = 0;
+    sampler.reset();
+    pressed = false;
+    raw_touch = -1;
+}
+void GuiCalibratorX11::on_layout_change()
+{
+    layout_changed = false;
+
+    const int old_width = screen_width, old_height = screen_height;
+    update_monitors();
+
+    int x, y, w, h;
+    get_monitor_size(x, y, w, h, monitor_nr);
+    if (x == window_x && y == window_y && w == window_width &&
+            h == window_height && old_width == screen_width &&
+            old_height == screen_height)
+        return;
+
+    // the clicks taken so far refer to the old geometry
+    move_window(x, y, w, h);
+    reset_ext();
+    layout_ext();
+    redraw();
+    draw_message("Screen layout changed, restarting...");
+}
 void GuiCalibratorX11::set_window_size(int x, int y, int width, int height) {
     window_width = width;
     window_height = height;
@@ -182,33 +257,22 @@ void GuiCalibratorX11::set_window_size(int x, int y, int width, int height) {
     window_y = y;
 
     // Compute absolute circle centers
-    const int delta_x = window_width / num_blocks;
-    const int delta_y = window_height / num_blocks;
-    X[UL] = delta_x;                    Y[UL] = delta_y;
-    X[UR] = window_width - delta_x - 1; Y[UR] = delta_y;
-    X[LL] = delta_x;                    Y[LL] = window_height - delta_y - 1;
-    X[LR] = window_width - delta_x - 1; Y[LR] = window_height - delta_y - 1;
+    X.resize(grid.size());
+    Y.resize(grid.size());
+    for (int i = 0 ; i < grid.size() ; i++) {
+        X[i] = grid.x(i, window_width);
+        Y[i] = grid.y(i, window_height);
+    }
 
     // reset calibration if already started
     points_count = 0;
+    retap = -1;
 }
 
 void GuiCalibratorX11::redraw()
 {
-
-
-#if 0
-    {
-    int x, y, w, h;
-    get_monitor_size(x, y, w, h, monitor_nr);
-    if (x != window_x || y != window_y || w != window_width || h != window_height) {
-
-          XMoveWindow(display, win, x, y);
-          XResizeWindow(display, win, w, h);
-          set_window_size(x, y, w, h);
-    }
-    }
-#endif
+    XSetForeground(display, gc, pixel[GRAY]);
+    XFillRectangle(display, buffer, gc, 0, 0, window_width, window_height);
 
     // Print the text
     int text_height = font_info->ascent + font_info->descent;
@@ -222,45 +286,153 @@ void GuiCalibratorX11::redraw()
     int y = (window_height - text_height) / 2 - 60;
     XSetForeground(display, gc, pixel[BLACK]);
     XSetLineAttributes(display, gc, 2, LineSolid, CapRound, JoinRound);
-    XDrawRectangle(display, win, gc, x - 10, y - (help_lines*text_height) - 10,
+    XDrawRectangle(display, buffer, gc, x - 10, y - (help_lines*text_height) - 10,
                 text_width + 20, (help_lines*text_height) + 20);
 
     // Print help lines
     y -= 3;
     for (int i = help_lines-1; i != -1; i--) {
         int w = XTextWidth(font_info, help_text[i].c_str(), help_text[i].length());
-        XDrawString(display, win, gc, x + (text_width-w)/2, y,
+        XDrawString(display, buffer, gc, x + (text_width-w)/2, y,
                 help_text[i].c_str(), help_text[i].length());
         y -= text_height;
     }
 
-    // Draw the points
-    for (int i = 0; i <= points_count; i++) {
-        // set color: already clicked or not
-        if (i < points_count)
-            XSetForeground(display, gc, pixel[WHITE]);
-        else
-            XSetForeground(display, gc, pixel[RED]);
-        XSetLineAttributes(display, gc, 1, LineSolid, CapRound, JoinRound);
-
-        XDrawLine(display, win, gc, X[i] - cross_lines, Y[i],
-                X[i] + cross_lines, Y[i]);
-        XDrawLine(display, win, gc, X[i], Y[i] - cross_lines,
-                X[i], Y[i] + cross_lines);
-        XDrawArc(display, win, gc, X[i] - cross_circle, Y[i] - cross_circle,
-                (2 * cross_circle), (2 * cross_circle), 0, 360 * 64);
+    message_box = {0, 0, 0, 0};
+    target_color.assign(grid.size(), -1);
+    draw_clock();
+    draw_targets();
+
+    damage(0, 0, window_width, window_height);
+}
+
+// Update the targets whose color changed
+void GuiCalibratorX11::draw_targets()
+{
+    bool clock = false;
+    for (int i = 0; i < grid.size(); i++) {
+        // already clicked or not
+        int color = -1;
+        if (i == retap || (retap < 0 && i == points_count))
+            color = RED;
+        else if (i < points_count)
+            color = WHITE;
+
+        if (color == target_color[i])
+            continue;
+        draw_target(i, color);
+        clock = clock || overlaps_clock(i);
     }
 
+    // erasing a target may have erased a piece of the clock
+    if (clock)
+        draw_clock();
+}
+void GuiCalibratorX11::draw_target(int i, int color)
+{
+    const int x = X[i] - cross_lines, y = Y[i] - cross_lines;
+    const int size = 2 * cross_lines + 1;
+
+    XSetForeground(display, gc, pixel[GRAY]);
+    XFillRectangle(display, buffer, gc, x, y, size, size);
+    target_color[i] = color;
+    paint_target(i);
+    damage(x, y, size, size);
+}
+// Draw target 'i' over the buffer content, without erasing
+void GuiCalibratorX11::paint_target(int i)
+{
+    if (target_color[i] < 0)
+        return;
+
+    XSetForeground(display, gc, pixel[target_color[i]]);
+    XSetLineAttributes(display, gc, 1, LineSolid, CapRound, JoinRound);
+
+    XDrawLine(display, buffer, gc, X[i] - cross_lines, Y[i],
+            X[i] + cross_lines, Y[i]);
+    XDrawLine(display, buffer, gc, X[i], Y[i] - cross_lines,
+            X[i], Y[i] + cross_lines);
+    XDrawArc(display, buffer, gc, X[i] - cross_circle, Y[i] - cross_circle,
+            (2 * cross_circle), (2 * cross_circle), 0, 360 * 64);
+}
+bool GuiCalibratorX11::overlaps_clock(int i) const
+{
+    const int limit = cross_lines + clock_radius / 2 + 1;
+    return std::abs(X[i] - window_width / 2) <= limit &&
+           std::abs(Y[i] - window_height / 2) <= limit;
+}
+void GuiCalibratorX11::draw_clock()
+{
+    const int x = (window_width - clock_radius) / 2;
+    const int y = (window_height - clock_radius) / 2;
+
+    XSetForeground(display, gc, pixel[GRAY]);
+    XFillRectangle(display, buffer, gc, x, y, clock_radius + 1, clock_radius + 1);
+
     // Draw the clock background
     XSetForeground(display, gc, pixel[DIMGRAY]);
     XSetLineAttributes(display, gc, 0, LineSolid, CapRound, JoinRound);
-    XFillArc(display, win, gc, (window_width-clock_radius)/2, (window_height - clock_radius)/2,
-                clock_radius, clock_radius, 0, 360 * 64);
+    XFillArc(display, buffer, gc, x, y, clock_radius, clock_radius, 0, 360 * 64);
+
+    draw_clock_arc();
 }
+void GuiCalibratorX11::draw_clock_arc()
+{
+    if (time_elapsed > 0) {
+        XSetForeground(display, gc, pixel[BLACK]);
+        XSetLineAttributes(display, gc, clock_line_width,
+                    LineSolid, CapButt, JoinMiter);
+        XDrawArc(display, buffer, gc, (window_width-clock_radius+clock_line_width)/2,
+                    (window_height-clock_radius+clock_line_width)/2,
+                    clock_radius-clock_line_width, clock_radius-clock_line_width,
+                    90*64, ((double)time_elapsed/(double)max_time) * -360 * 64);
+    }
 
-void GuiCalibratorX11::on_expose_event()
+    // the targets under the clock (e.g. the central one) stay visible
+    for (int i = 0; i < grid.size(); i++)
+        if (overlaps_clock(i))
+            paint_target(i);
+
+    damage((window_width - clock_radius) / 2, (window_height - clock_radius) / 2,
+           clock_radius + 1, clock_radius + 1);
+}
+void GuiCalibratorX11::damage(int x, int y, int width, int height)
 {
-    redraw();
+    for (auto &r : damaged)
+        if (x >= r.x && y >= r.y && x + width <= r.x + r.width &&
+                y + height <= r.y + r.height)
+            return;
+    damaged.push_back({(short)x, (short)y,
+                       (unsigned short)width, (unsigned short)height});
+}
+// Copy the damaged rectangles to the window, and end the frame
+void GuiCalibratorX11::flush()
+{
+    if (damaged.size()) {
+        for (auto &r : damaged)
+            XCopyArea(display, buffer, win, gc, r.x, r.y, r.width, r.height,
+                      r.x, r.y);
+        damaged.clear();
+
+        const unsigned long requests = NextRequest(display) - frame_start;
+        draw_stats.frames++;
+        draw_stats.requests += requests;
+        draw_stats.max_requests = std::max(draw_stats.max_requests, requests);
+        XFlush(display);
+
+        // from the click to the new targets sent to the server
+        if (feedback_pending) {
+            latency->add("feedback", LatencyStats::now_ms() - dispatch_ms,
+                         requests);
+            feedback_pending = false;
+        }
+    }
+    frame_start = NextRequest(display);
+}
+
+void GuiCalibratorX11::on_expose_event(const XExposeEvent &event)
+{
+    damage(event.x, event.y, event.width, event.height);
 }
 
 void GuiCalibratorX11::on_timer_signal()
@@ -273,42 +445,244 @@ void GuiCalibratorX11::on_timer_signal()
     }
 
     // Update clock
-    XSetForeground(display, gc, pixel[BLACK]);
-    XSetLineAttributes(display, gc, clock_line_width,
-                LineSolid, CapButt, JoinMiter);
-    XDrawArc(display, win, gc, (window_width-clock_radius+clock_line_width)/2,
-                (window_height-clock_radius+clock_line_width)/2,
-                clock_radius-clock_line_width, clock_radius-clock_line_width,
-                90*64, ((double)time_elapsed/(double)max_time) * -360 * 64);
+    draw_clock_arc();
 }
 
 void GuiCalibratorX11::on_button_press_event(XEvent event)
 {
-    // Clear window, maybe a bit overdone, but easiest for me atm.
-    // (goal is to clear possible message and other clicks)
-    XClearWindow(display, win);
+    on_press(event.xbutton.x, event.xbutton.y);
+}
+
+void GuiCalibratorX11::on_press(double x, double y)
+{
+    if (max_samples <= 1) {
+        on_click(x, y);
+        return;
+    }
+
+    pressed = true;
+    on_sample(x, y);
+}
+
+void GuiCalibratorX11::on_motion(double x, double y)
+{
+    // press-and-hold: every motion is a further sample
+    if (pressed)
+        on_sample(x, y);
+}
+
+void GuiCalibratorX11::on_release()
+{
+    if (!pressed)
+        return;
+    pressed = false;
+
+    // not converged yet: ask another tap on the same target
+    time_elapsed = 0;
+    char msg[100];
+    snprintf(msg, sizeof(msg), "Press the target again (%d samples, +/- %.1f pixels)",
+             sampler.count(), sampler.confidence());
+    draw_message(msg);
+    draw_clock();
+}
+
+void GuiCalibratorX11::on_sample(double x, double y)
+{
+    sampler.add(x, y);
+    time_elapsed = 0;
+
+    /*
+     * advance as soon as the mean is known well enough (or there are
+     * enough samples); the remaining samples of this press are ignored
+     */
+    if (sampler.confidence() <= sample_threshold ||
+            sampler.count() >= max_samples) {
+        pressed = false;
+        on_click(sampler.mean_x(), sampler.mean_y());
+    }
+}
+
+// Take the time of an input event, for the latency stats
+void GuiCalibratorX11::on_input(Time time)
+{
+    if (!latency)
+        return;
+    dispatch_ms = LatencyStats::now_ms();
+    event_delay = LatencyStats::since_server_time(time);
+}
+void GuiCalibratorX11::on_click(double x, double y)
+{
+    if (latency) {
+        if (event_delay >= 0)
+            latency->add("event", event_delay);
+        feedback_pending = true;
+    }
+
+    clear_message();
 
     // Handle click
     time_elapsed = 0;
-    bool success = add_click_ext(event.xbutton.x, event.xbutton.y);
+    sampler.reset();
 
-    if (!success) {
+    bool misclick = false;
+    {
+        LatencyScope scope(latency, display, "add_click");
+        if (retap >= 0) {
+            replace_click_ext(retap, x, y);
+            retap = -1;
+        } else if (add_click_ext(x, y)) {
+            points_count ++;
+        } else {
+            misclick = true;
+        }
+    }
+    if (misclick && robust) {
+        // only this tap is dropped (e.g. a double click)
+        draw_message("Click rejected, press the red target again");
+    } else if (misclick) {
         draw_message("Mis-click detected, restarting...");
         points_count = 0;
         reset_ext();
-    } else {
-        points_count ++;
     }
 
     // Are we done yet?
-    if (points_count >= 4) {
-        return_value = true;
-        do_loop = false;
+    if (points_count >= grid.size()) {
+        // ask again the inconsistent target; after too many attempts the
+        // outliers are left to the fit
+        if (nr_retaps < grid.size()) {
+            LatencyScope scope(latency, display, "outlier");
+            retap = find_outlier_ext();
+        }
+        if (retap < 0) {
+            return_value = true;
+            do_loop = false;
+            return;
+        }
+        nr_retaps++;
+        draw_message("Inconsistent point, press the red target again");
+    }
+
+    // Update the changed targets, and restart the clock
+    LatencyScope scope(latency, display, "draw");
+    draw_targets();
+    draw_clock();
+}
+
+bool GuiCalibratorX11::enable_xi2(XID device_id)
+{
+    int event, error;
+    if (!XQueryExtension(display, "XInputExtension", &xi_opcode, &event,
+                         &error)) {
+        fprintf(stderr, "ERROR: XInput extension not available\n");
+        return false;
+    }
+
+    // the raw touch events need XI 2.2
+    int major = XI2_MAJOR, minor = XI2_MINOR;
+    if (XIQueryVersion(display, &major, &minor) != Success ||
+            major < 2 || (major == 2 && minor < 2)) {
+        fprintf(stderr, "ERROR: XInput 2.2 not available\n");
+        return false;
+    }
+
+    // the range of the x and y axes, to normalize the raw values
+    int n;
+    XIDeviceInfo *info = XIQueryDevice(display, device_id, &n);
+    if (!info) {
+        fprintf(stderr, "ERROR: unable to query the device %lu\n", device_id);
+        return false;
+    }
+    int found = 0;
+    for (int i = 0 ; i < info->num_classes ; i++) {
+        if (info->classes[i]->type != XIValuatorClass)
+            continue;
+        auto v = (XIValuatorClassInfo *)info->classes[i];
+        if (v->number > 1 || v->max <= v->min)
+            continue;
+        raw_min[v->number] = v->min;
+        raw_max[v->number] = v->max;
+        found |= 1 << v->number;
+    }
+    XIFreeDeviceInfo(info);
+    if (found != 3) {
+        fprintf(stderr, "ERROR: the device %lu has no absolute x/y axes\n",
+                device_id);
+        return false;
+    }
+
+    /*
+     * The raw events are delivered only to the root window; selecting them
+     * for 'device_id' leaves out the other pointer devices
+     */
+    unsigned char mask[XIMaskLen(XI_LASTEVENT)] = {0};
+    XIEventMask evmask;
+    evmask.deviceid = device_id;
+    evmask.mask_len = sizeof(mask);
+    evmask.mask = mask;
+    XISetMask(mask, XI_RawButtonPress);
+    XISetMask(mask, XI_RawButtonRelease);
+    XISetMask(mask, XI_RawMotion);
+    XISetMask(mask, XI_RawTouchBegin);
+    XISetMask(mask, XI_RawTouchUpdate);
+    XISetMask(mask, XI_RawTouchEnd);
+    XISelectEvents(display, RootWindow(display, screen_num), &evmask, 1);
+
+    xi2_device_id = device_id;
+    return true;
+}
+
+void GuiCalibratorX11::on_raw_event(XGenericEventCookie *cookie)
+{
+    auto ev = (XIRawEvent *)cookie->data;
+    if ((XID)ev->deviceid != xi2_device_id)
         return;
+    on_input(ev->time);
+
+    // the first touch (or the button 1) only
+    switch (cookie->evtype) {
+        case XI_RawTouchBegin:
+            if (raw_touch >= 0)
+                return;
+            raw_touch = ev->detail;
+            break;
+        case XI_RawTouchUpdate:
+        case XI_RawTouchEnd:
+            if ((int)ev->detail != raw_touch)
+                return;
+            break;
+        case XI_RawButtonPress:
+        case XI_RawButtonRelease:
+            if (ev->detail != 1)
+                return;
+            break;
     }
 
-    // Force a redraw
-    redraw();
+    if (cookie->evtype == XI_RawTouchEnd || cookie->evtype == XI_RawButtonRelease) {
+        raw_touch = -1;
+        on_release();
+        return;
+    }
+
+    // raw_values has only the valuators set in the mask
+    const double *val = ev->raw_values;
+    for (int i = 0 ; i < 2 && i < ev->valuators.mask_len * 8 ; i++) {
+        if (XIMaskIsSet(ev->valuators.mask, i))
+            raw_pos[i] = *val++;
+    }
+
+    /*
+     * device coordinates -> window coordinates: with the prescale matrix
+     * (see main.cc) the normalized device space covers the window
+     */
+    const double x = (raw_pos[0] - raw_min[0]) / (raw_max[0] - raw_min[0]) *
+                     window_width;
+    const double y = (raw_pos[1] - raw_min[1]) / (raw_max[1] - raw_min[1]) *
+                     window_height;
+
+    if (cookie->evtype == XI_RawTouchBegin || cookie->evtype == XI_RawButtonPress)
+        on_press(x, y);
+    else
+        on_motion(x, y);
 }
 
 void GuiCalibratorX11::draw_message(const char* msg)
@@ -318,31 +692,89 @@ void GuiCalibratorX11::draw_message(const char* msg)
 
     int x = (window_width - text_width) / 2;
     int y = (window_height - text_height) / 2 + clock_radius + 60;
+
+    clear_message();
     XSetForeground(display, gc, pixel[BLACK]);
     XSetLineAttributes(display, gc, 2, LineSolid, CapRound, JoinRound);
-    XDrawRectangle(display, win, gc, x - 10, y - text_height - 10,
+    XDrawRectangle(display, buffer, gc, x - 10, y - text_height - 10,
                 text_width + 20, text_height + 25);
 
-    XDrawString(display, win, gc, x, y, msg, strlen(msg));
+    XDrawString(display, buffer, gc, x, y, msg, strlen(msg));
+
+    // the box and its line width
+    message_box = {(short)(x - 11), (short)(y - text_height - 11),
+                   (unsigned short)(text_width + 23),
+                   (unsigned short)(text_height + 28)};
+    damage(message_box.x, message_box.y, message_box.width, message_box.height);
+}
+void GuiCalibratorX11::clear_message()
+{
+    if (!message_box.width)
+        return;
+
+    XSetForeground(display, gc, pixel[GRAY]);
+    XFillRectangle(display, buffer, gc, message_box.x, message_box.y,
+                   message_box.width, message_box.height);
+    damage(message_box.x, message_box.y, message_box.width, message_box.height);
+    message_box = {0, 0, 0, 0};
 }
 
 void GuiCalibratorX11::on_xevent()
 {
-    // process events
+    // process all the events read, also the ones of other windows: the
+    // reactor waits only for new data on the connection
     XEvent event;
-    while (XCheckWindowEvent(display, win, -1, &event) == True) {
+    while (do_loop && XPending(display)) {
+        XNextEvent(display, &event);
+
+        // the XI2 events are not tied to the window
+        if (event.type == GenericEvent) {
+            auto cookie = &event.xcookie;
+            if (!xi2_device_id || cookie->extension != xi_opcode ||
+                    !XGetEventData(display, cookie))
+                continue;
+            on_raw_event(cookie);
+            XFreeEventData(display, cookie);
+            continue;
+        }
+        if (rr_event_base &&
+                (event.type == rr_event_base + RRScreenChangeNotify ||
+                 event.type == rr_event_base + RRNotify)) {
+            // update the screen size known by Xlib
+            XRRUpdateConfiguration(&event);
+            layout_changed = true;
+            continue;
+        }
+        if (event.xany.window != win)
+            continue;
+
         switch (event.type) {
             case Expose:
-                // only draw the last contiguous expose
-                if (event.xexpose.count != 0)
-                    break;
-                on_expose_event();
+                on_expose_event(event.xexpose);
                 break;
 
+            // with XI2 the clicks come from on_raw_event()
             case ButtonPress:
+                if (xi2_device_id)
+                    break;
+                on_input(event.xbutton.time);
                 on_button_press_event(event);
                 break;
 
+            case ButtonRelease:
+                if (xi2_device_id)
+                    break;
+                on_input(event.xbutton.time);
+                on_release();
+                break;
+
+            case MotionNotify:
+                if (xi2_device_id)
+                    break;
+                on_input(event.xmotion.time);
+                on_motion(event.xmotion.x, event.xmotion.y);
+                break;
+
             case KeyPress:
                 /* FIXME */
                 return_value = false;
@@ -351,32 +783,55 @@ void GuiCalibratorX11::on_xevent()
                 break;
         }
     }
+
+    // a burst of RandR events is handled once
+    if (do_loop && layout_changed)
+        on_layout_change();
 }
 
 bool GuiCalibratorX11::mainloop() {
 
-    // This returns the FD of the X11 display (or something like that)
-    auto x11_fd = ConnectionNumber(display);
-
     do_loop = true;
+    auto check_loop = [&](){
+        if (!do_loop)
+            reactor.stop();
+    };
 
-    // Main loop
-    while(do_loop) {
-        fd_set in_fds;
-        struct timeval tv;
+    // This returns the FD of the X11 display (or something like that)
+    reactor.add_fd(ConnectionNumber(display), [&](){
+        on_xevent();
+        check_loop();
+    });
+    reactor.set_timer(time_step, [&](uint64_t ticks){
+        for (uint64_t i = 0 ; i < ticks && do_loop ; i++)
+            on_timer_signal();
+        check_loop();
+    });
+
+    // when interrupted, end as for a timeout: the old matrix is restored
+    for (int signum : {SIGINT, SIGTERM, SIGHUP}) {
+        reactor.add_signal(signum, [&](int){
+            return_value = false;
+            do_loop = false;
+            check_loop();
+        });
+    }
 
-        tv.tv_sec = time_step / 1000;
-        tv.tv_usec = (time_step % 1000) * 1000;
+    reactor.set_prepare([&](){
+        // Xlib may have read events that epoll doesn't see anymore
+        if (XEventsQueued(display, QueuedAlready))
+            on_xevent();
+        flush();
+        XFlush(display);
+        check_loop();
+    });
 
-        // Create a File Description Set containing x11_fd
-        FD_ZERO(&in_fds);
-        FD_SET(x11_fd, &in_fds);
+    // the setup (window, grabs, calibrator...) is not counted as a frame
+    frame_start = NextRequest(display);
+    bool ok = reactor.run();
 
-        // Wait for X Event or a Timer
-        if (!select(x11_fd+1, &in_fds, 0, 0, &tv))
-            on_timer_signal();
-        on_xevent();
-    }
+    reactor.set_timer(0, nullptr);
+    reactor.remove_fd(ConnectionNumber(display));
 
-    return return_value;
+    return ok && return_value;
 }
@@ -28,34 +28,20 @@
 #include <functional>
 #include <utility>
 
+#include "grid.hpp"
+#include "latency.hpp"
+#include "reactor.hpp"
+#include "solver.hpp"
+
 enum { BLACK=0, WHITE=1, GRAY=2, DIMGRAY=3, RED=4 };
 inline const int nr_colors = 5;
-/*
- * Number of blocks. We partition the screen into 'num_blocks' x 'num_blocks'
- * rectangles of equal size. We then ask the user to press points that are
- * located at the corner closes to the center of the four blocks in the corners
- * of the screen. The following ascii art illustrates the situation. We partition
- * the screen into 8 blocks in each direction. We then let the user press the
- * points marked with 'O'.
- *
- *   +--+--+--+--+--+--+--+--+
- *   |  |  |  |  |  |  |  |  |
- *   +--O--+--+--+--+--+--O--+
- *   |  |  |  |  |  |  |  |  |
- *   +--+--+--+--+--+--+--+--+
- *   |  |  |  |  |  |  |  |  |
- *   +--+--+--+--+--+--+--+--+
- *   |  |  |  |  |  |  |  |  |
- *   +--+--+--+--+--+--+--+--+
- *   |  |  |  |  |  |  |  |  |
- *   +--+--+--+--+--+--+--+--+
- *   |  |  |  |  |  |  |  |  |
- *   +--+--+--+--+--+--+--+--+
- *   |  |  |  |  |  |  |  |  |
- *   +--O--+--+--+--+--+--O--+
- *   |  |  |  |  |  |  |  |  |
- *   +--+--+--+--+--+--+--+--+
- */
+
+/// number of X requests sent to update the window
+struct DrawStats {
+    unsigned long frames = 0;
+    unsigned long requests = 0;
+    unsigned long max_requests = 0;
+};
 
 /*******************************************
  * X11 class for the the calibration GUI
@@ -65,18 +51,64 @@ class GuiCalibratorX11
 public:
     ~GuiCalibratorX11();
     bool mainloop();
-    GuiCalibratorX11(Display *display, int monitor_nr = 1);
+    GuiCalibratorX11(Display *display, int monitor_nr = 1,
+                     const CalibrationGrid &grid = CalibrationGrid());
 
 private:
     // Data
-    double X[4], Y[4];
+    CalibrationGrid grid;
+    std::vector<double> X, Y;
     int window_x, window_y, window_width, window_height;
     int time_elapsed;
     int points_count;
+    int retap = -1;         // target to press again, or -1
+    bool robust = false;    // a rejected click doesn't restart
+    int nr_retaps = 0;
+    // multi-sample mode: the samples of the current target
+    int max_samples = 1;
+    double sample_threshold = 1.0;
+    PointSampler sampler;
+    bool pressed = false;
+    // XI2 raw capture (0: core events)
+    XID xi2_device_id = 0;
+    int xi_opcode = 0;
+    double raw_min[2], raw_max[2], raw_pos[2] = {0, 0};
+    int raw_touch = -1;
     bool return_value;
     bool do_loop;
     int monitor_nr = 0;
-    const int num_blocks = 8;
+
+    /*
+     * RandR monitor layout, read once and then again only when the server
+     * notifies a change (rr_event_base = 0: RandR not available)
+     */
+    struct MonitorRect {
+        int x, y, width, height;
+    };
+    std::vector<MonitorRect> monitors;
+    bool monitors_valid = false;
+    int screen_width = 0, screen_height = 0;
+    int rr_event_base = 0;
+    bool layout_changed = false;
+
+    /*
+     * Everything is drawn in 'buffer', then only the changed rectangles
+     * are copied to the window: a frame is the set of requests sent
+     * between two flush()
+     */
+    Pixmap buffer;
+    std::vector<XRectangle> damaged;
+    std::vector<int> target_color;  // as drawn in buffer, -1: none
+    XRectangle message_box = {0, 0, 0, 0};
+    unsigned long frame_start = 0;
+
+    Reactor reactor;
+
+    // latency stats (NULL: disabled) of the current input event
+    LatencyStats *latency = nullptr;
+    double dispatch_ms = 0;
+    double event_delay = -1;
+    bool feedback_pending = false;
 
     // X11 vars
     Display* display;
@@ -86,29 +118,107 @@ private:
     XFontStruct* font_info;
     // color mngmt
     unsigned long pixel[nr_colors];
+    DrawStats draw_stats;
 
 
     // event handlers
     void on_timer_signal();
     void on_xevent();
-    void on_expose_event();
+    void on_expose_event(const XExposeEvent &event);
     void on_button_press_event(XEvent event);
+    void on_raw_event(XGenericEventCookie *cookie);
+    void on_input(Time time);
+    void on_layout_change();
+    void on_press(double x, double y);
+    void on_motion(double x, double y);
+    void on_release();
+    void on_sample(double x, double y);
+    void on_click(double x, double y);
 
     // Helper functions
     void set_window_size(int x, int y, int width, int height);
+    void move_window(int x, int y, int width, int height);
+    void update_monitors();
     void redraw();
+    void draw_targets();
+    void draw_target(int i, int color);
+    void paint_target(int i);
+    void draw_clock();
+    void draw_clock_arc();
     void draw_message(const char* msg);
+    void clear_message();
+    bool overlaps_clock(int i) const;
+    void damage(int x, int y, int width, int height);
+    void flush();
 
-    std::function<bool(int, int)> add_click_ext = [](int x, int y){ return true; };
+    std::function<bool(double, double)> add_click_ext = [](double x, double y){ return true; };
     std::function<void(void)> reset_ext = [](){ };
+    std::function<int(void)> find_outlier_ext = [](){ return -1; };
+    std::function<bool(int, double, double)> replace_click_ext =
+        [](int i, double x, double y){ return true; };
+    std::function<void(void)> layout_ext = [](){ };
 
 public:
-    void set_add_click(std::function<bool(int, int)> f) {
+    void set_add_click(std::function<bool(double, double)> f) {
         add_click_ext = f;
     }
     void set_reset(std::function<void(void)> f) {
         reset_ext = f;
     }
+    /// robust mode: a rejected click is asked again, without restarting
+    void set_robust(bool r) {
+        robust = r;
+    }
+    /// called when all the targets are pressed: return the one to redo
+    void set_find_outlier(std::function<int(void)> f) {
+        find_outlier_ext = f;
+    }
+    void set_replace_click(std::function<bool(int, double, double)> f) {
+        replace_click_ext = f;
+    }
+    /*
+     * called when the monitor or the screen geometry changes: the targets
+     * are moved and the calibration restarts (reset is called too)
+     */
+    void set_layout_change(std::function<void(void)> f) {
+        layout_ext = f;
+    }
+    /*
+     * take up to 'max' samples for each target (taps, or motion while
+     * pressed), and advance when the 95% confidence interval of the mean
+     * is less than 'threshold' pixels
+     */
+    void set_sampling(int max, double threshold) {
+        max_samples = max;
+        sample_threshold = threshold;
+    }
+
+    /*
+     * take the clicks from the XI2 raw events of 'device_id' instead of the
+     * core pointer events: the coordinates are the device ones (sub-pixel,
+     * not affected by the calibration matrix), scaled to the window
+     */
+    bool enable_xi2(XID device_id);
+
+    /*
+     * start again on the monitor 'monitor_nr', reusing the window, the
+     * font and the GC (e.g. to calibrate another device); the callbacks
+     * and the XI2 device have to be set again
+     */
+    void set_monitor(int monitor_nr);
+
+    const DrawStats &get_draw_stats() const { return draw_stats; }
+
+    /*
+     * record in 'stats' the latencies from the input events to the window
+     * update: "event" (server timestamp -> read by the client), "add_click",
+     * "outlier", "draw" (drawing in the buffer) and "feedback" (event read
+     * -> window updated)
+     */
+    void set_latency_stats(LatencyStats *stats) { latency = stats; }
+
+    /// the event loop of mainloop(), to watch other fds too
+    Reactor &get_reactor() { return reactor; }
 
     void get_overall_display_size( int &width, int &height);
     void get_monitor_size(int &x, int &y, int &w, int &h, int monitor_num = 0);
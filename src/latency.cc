@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2024 Goffredo Baroncelli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <time.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "latency.hpp"
+
+double LatencyStats::now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+double LatencyStats::since_server_time(Time time)
+{
+    // the server time is a 32 bit counter of milliseconds
+    const double now = now_ms();
+    const int32_t delta = (uint32_t)(uint64_t)now - (uint32_t)time;
+
+    // a remote server, or a different clock
+    if (delta < 0 || delta > 60 * 1000)
+        return -1;
+
+    return delta + (now - std::floor(now));
+}
+
+void LatencyStats::add(const std::string &phase, double msec,
+                       unsigned long requests, bool waited)
+{
+    auto it = std::find_if(phases.begin(), phases.end(),
+                           [&](const Phase &p){ return p.name == phase; });
+    if (it == phases.end()) {
+        phases.push_back(Phase());
+        phases.back().name = phase;
+        it = phases.end() - 1;
+    }
+
+    it->samples.push_back(msec);
+    it->requests += requests;
+    if (waited)
+        it->waited++;
+}
+
+const LatencyStats::Phase *LatencyStats::find(const std::string &phase) const
+{
+    for (auto &p : phases)
+        if (p.name == phase)
+            return &p;
+    return nullptr;
+}
+
+int LatencyStats::count(const std::string &phase) const
+{
+    auto p = find(phase);
+    return p ? p->samples.size() : 0;
+}
+
+double LatencyStats::percentile(const std::string &phase, double pct) const
+{
+    auto p = find(phase);
+    if (!p || p->samples.empty())
+        return 0;
+
+    auto v = p->samples;
+    std::sort(v.begin(), v.end());
+    size_t rank = std::ceil(pct / 100 * v.size());
+    return v[std::min(std::max(rank, (size_t)1), v.size()) - 1];
+}
+
+void LatencyStats::print(FILE *out) const
+{
+    fprintf(out, "%-12s %7s %9s %9s %9s %9s %7s\n", "Phase (msec)",
+            "count", "p50", "p95", "max", "requests", "waited");
+    for (auto &p : phases) {
+        fprintf(out, "%-12s %7zu %9.3f %9.3f %9.3f %9lu %7lu\n",
+                p.name.c_str(), p.samples.size(),
+                percentile(p.name, 50), percentile(p.name, 95),
+                percentile(p.name, 100), p.requests, p.waited);
+    }
+}
+
+LatencyScope::LatencyScope(LatencyStats *stats_, Display *display_,
+                           const char *phase_)
+  : stats(stats_), display(display_), phase(phase_)
+{
+    if (!stats)
+        return;
+    first_request = NextRequest(display);
+    start = LatencyStats::now_ms();
+}
+
+LatencyScope::~LatencyScope()
+{
+    if (!stats)
+        return;
+
+    // a reply to one of the requests of the scope was read
+    const bool waited = LastKnownRequestProcessed(display) >= first_request;
+    stats->add(phase, LatencyStats::now_ms() - start,
+               NextRequest(display) - first_request, waited);
+}
+
+#ifdef TEST_LATENCY
+
+#include <cassert>
+
+void test_latency_percentile() {
+    LatencyStats s;
+
+    for (int i = 100 ; i >= 1 ; i--)
+        s.add("a", i);
+    s.add("b", 7, 3, true);
+
+    assert(s.count("a") == 100);
+    assert(s.count("b") == 1);
+    assert(s.count("c") == 0);
+    assert(s.percentile("a", 50) == 50);
+    assert(s.percentile("a", 95) == 95);
+    assert(s.percentile("a", 100) == 100);
+    assert(s.percentile("a", 0) == 1);
+    assert(s.percentile("b", 95) == 7);
+    assert(s.percentile("c", 50) == 0);
+}
+
+void test_latency_server_time() {
+    const double now = LatencyStats::now_ms();
+    const Time t = (Time)(uint32_t)(uint64_t)now;
+
+    double d = LatencyStats::since_server_time(t - 5);
+    assert(d >= 5 && d < 7);
+
+    // in the future or too old: not the same clock
+    assert(LatencyStats::since_server_time(t + 1000) < 0);
+    assert(LatencyStats::since_server_time(t - 120 * 1000) < 0);
+}
+
+#define TEST(x) \
+    fprintf(stderr, "Start test " #x "... "); \
+    x(); \
+    fprintf(stderr, "OK\n");
+
+int main(int argc, char **argv) {
+    TEST(test_latency_percentile);
+    TEST(test_latency_server_time);
+}
+
+#endif
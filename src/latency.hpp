@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2024 Goffredo Baroncelli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <X11/Xlib.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*
+ * Latency measurements, grouped by phase (e.g. "add_click", "save"). For
+ * each sample it is recorded the time, the X requests sent and if the
+ * phase waited for a reply of the server (at least once: the replies
+ * aren't counted, so it is not the number of round trips). The times are
+ * in milliseconds, from CLOCK_MONOTONIC: the same clock of the X server
+ * timestamps of a local Xorg.
+ */
+class LatencyStats {
+public:
+    static double now_ms();
+
+    /*
+     * milliseconds elapsed since the X server 'time' (of an event); -1 if
+     * the server clock is not comparable with the local one
+     */
+    static double since_server_time(Time time);
+
+    void add(const std::string &phase, double msec,
+             unsigned long requests = 0, bool waited = false);
+
+    /// percentile 'p' (0..100) of the times of 'phase', nearest rank
+    double percentile(const std::string &phase, double p) const;
+    int count(const std::string &phase) const;
+
+    /// print a table with p50/p95/max, the X requests and the waits of each phase
+    void print(FILE *out = stdout) const;
+
+private:
+    struct Phase {
+        std::string name;
+        std::vector<double> samples;
+        unsigned long requests = 0;
+        /// samples that waited for a reply
+        unsigned long waited = 0;
+    };
+    // in order of first use
+    std::vector<Phase> phases;
+
+    const Phase *find(const std::string &phase) const;
+};
+
+/*
+ * Measure a block of code: the time, and the requests sent to 'display'
+ * from the construction to the destruction. Nothing is done when 'stats'
+ * is NULL.
+ */
+class LatencyScope {
+public:
+    LatencyScope(LatencyStats *stats, Display *display, const char *phase);
+    ~LatencyScope();
+
+private:
+    LatencyStats *stats;
+    Display *display;
+    const char *phase;
+    double start = 0;
+    unsigned long first_request = 0;
+};
@@ -24,10 +24,17 @@
 #include <unistd.h>
 #include <cstdio>
 #include <cstring>
+#include <cmath>
+#include <memory>
 
 #include "gui_x11.hpp"
 #include "calibrator.hpp"
 #include "xinput.hpp"
+#include "daemon.hpp"
+#include "fleet.hpp"
+#include "offline.hpp"
+#include "output.hpp"
+#include "latency.hpp"
 
 extern const char *gitversion;
 
@@ -39,6 +46,10 @@ void show_help() {
         "    --output-file-udev-libinput-cmd=<filename>     save the output to filename\n"
         "    --threshold-misclick=<nn>     set the threshold for misclick to <nn>\n"
         "    --threshold-doubleclick=<nn>  set the threshold for doubleckick to <nn>\n"
+        "    --robust                      ask again only the inconsistent points\n"
+        "    --samples=<n>                 take up to <n> samples for each target\n"
+        "    --sample-threshold=<px>       advance when the mean is known within <px>\n"
+        "    --xi2                         read the raw device coordinates (XInput 2.2)\n"
         "    --device-name=<devname>       set the touch screen device by name\n"
         "    --device-id=<devid>           set the touch screen device by id\n"
         "    --matrix-name=<matrix name>   set the calibration matrix name\n"
@@ -46,13 +57,31 @@ void show_help() {
         "    --show-xinput-cmd             show the config for xinput-libinput\n"
         "    --show-udev-libinput-cmd      show the config for udev-libinput\n"
         "    --show-matrix                 show the final matrix\n"
+        "    --show-stats                  show the error of each target\n"
+        "    --stats                       show the latency of each phase\n"
         "    --verbose                     set verbose to on\n"
         "    --dont-save                   don't update X11 setting\n"
         "    --start-matrix=x1,x2..x9      start coefficient matrix\n"
         "    --display=<display>           set the X11 display\n"
         "    --monitor-number=<n>          show the output on the monitor '<n>'\n"
+        "    --calibrate=<dev>:<n>[,..]    calibrate several devices, each one on\n"
+        "                                  its monitor, then apply all the results\n"
+        "    --grid=<cols>x<rows>          set the number of targets (default 2x2)\n"
+        "    --grid-inset=<f>              set the distance of the targets from the\n"
+        "                                  border, as fraction of the size (0.125)\n"
         "\n"
         "xlibinput_calibrator --list-devices       show the devices availables\n"
+        "    --format=text|json|ndjson     set the output format\n"
+        "    --props=<name>[,<name>..]     show only these properties\n"
+        "xlibinput_calibrator --apply --start-matrix=x1,x2..x9 [opts]\n"
+        "                     apply the matrix and exit, without calibrating\n"
+        "xlibinput_calibrator --daemon --start-matrix=x1,x2..x9 [opts]\n"
+        "                     apply the matrix again each time the device is plugged\n"
+        "    --watch=log|revert            log or revert the changes of the matrix\n"
+        "xlibinput_calibrator --fleet=<filename> [--fleet-jobs=<n>] [opts]\n"
+        "                     apply the matrices listed in filename to many displays\n"
+        "xlibinput_calibrator --solve-from=<filename> [opts]\n"
+        "                     compute the matrices from the recorded clicks, without X\n"
         "\n"
         "version: %s\n"
         "\n",
@@ -83,6 +112,62 @@ unsigned long stou(std::string_view s)
     return ret;
 }
 
+/* --apply: the X errors are reported instead of ending the program */
+static int apply_x_error = 0;
+
+static int apply_error_handler(Display *display, XErrorEvent *ev) {
+    apply_x_error = ev->error_code;
+    return 0;
+}
+
+/// a device to calibrate, and the monitor where to show the targets
+struct CalibrateTarget {
+    XID         device_id = (XID)-1;
+    std::string device_name;
+    int         monitor_nr = 0;
+    /// resolved before the calibration
+    std::string matrix_name;
+};
+
+/*
+ * Parse "<device>:<monitor>[,<device>:<monitor>..]": the device is an id
+ * or a name, the monitor a number or 'all'
+ */
+static bool parse_calibrate_list(const std::string &list,
+                                 std::vector<CalibrateTarget> &targets)
+{
+    size_t start = 0;
+    while (start <= list.size()) {
+        auto end = list.find(',', start);
+        if (end == std::string::npos)
+            end = list.size();
+        const std::string item = list.substr(start, end - start);
+        start = end + 1;
+
+        auto colon = item.rfind(':');
+        if (colon == std::string::npos || colon == 0 || colon + 1 == item.size())
+            return false;
+
+        CalibrateTarget t;
+        const std::string dev = item.substr(0, colon);
+        const std::string mon = item.substr(colon + 1);
+        if (dev.find_first_not_of("0123456789") == std::string::npos)
+            t.device_id = stou(dev);
+        else
+            t.device_name = dev;
+        if (mon == "all")
+            t.monitor_nr = -1;
+        else if (mon.find_first_not_of("0123456789") == std::string::npos)
+            t.monitor_nr = stoi(mon);
+        else
+            return false;
+
+        targets.push_back(t);
+    }
+
+    return true;
+}
+
 static void print_device_not_found(const std::vector<XInputTouch::XDevInfo> &v) {
     printf("ERROR: Unable to find a default touchscreen to calibrate\n");
     if (v.size() > 1) {
@@ -94,14 +179,169 @@ static void print_device_not_found(const std::vector<XInputTouch::XDevInfo> &v)
     }
 }
 
-static int list_devices(Display *display) {
+/* length of the UTF-8 sequence at 's[i]', or 0 if it is not valid */
+static size_t utf8_length(const std::string &s, size_t i) {
+    const unsigned char c = s[i];
+    size_t len;
+    unsigned char lo = 0x80, hi = 0xbf;    // range of the second byte
+
+    if (c < 0x80)
+        return 1;
+    else if (c >= 0xc2 && c <= 0xdf)
+        len = 2;
+    else if (c >= 0xe0 && c <= 0xef)
+        len = 3;
+    else if (c >= 0xf0 && c <= 0xf4)
+        len = 4;
+    else
+        return 0;
+
+    // no overlong forms, surrogates or code points above U+10FFFF
+    if (c == 0xe0)
+        lo = 0xa0;
+    else if (c == 0xed)
+        hi = 0x9f;
+    else if (c == 0xf0)
+        lo = 0x90;
+    else if (c == 0xf4)
+        hi = 0x8f;
+
+    if (i + len > s.size())
+        return 0;
+    for (size_t j = 1 ; j < len ; j++) {
+        const unsigned char cc = s[i + j];
+        if (cc < (j == 1 ? lo : 0x80) || cc > (j == 1 ? hi : 0xbf))
+            return 0;
+    }
+
+    return len;
+}
+
+static void json_string(const std::string &s) {
+    putchar('"');
+    for (size_t i = 0 ; i < s.size() ; ) {
+        const unsigned char c = s[i];
+        const size_t len = utf8_length(s, i);
+        if (len == 0) {
+            // the names come from the drivers: not always valid UTF-8
+            printf("\\ufffd");
+            i++;
+            continue;
+        }
+        if (c == '"' || c == '\\')
+            printf("\\%c", c);
+        else if (c < 0x20)
+            printf("\\u%04x", c);
+        else
+            fwrite(s.data() + i, 1, len, stdout);
+        i += len;
+    }
+    putchar('"');
+}
+
+static void json_value(XAtoms &atoms, const XPropData &value) {
+    printf("[");
+
+    if (value.type == XA_STRING && value.format == 8) {
+        // the strings are stored one after the other, 0 terminated
+        auto p = (const char *)value.item(0);
+        auto end = p + value.size();
+        for (bool first = true ; p < end ; first = false) {
+            auto len = strnlen(p, end - p);
+            if (!first)
+                printf(", ");
+            json_string(std::string(p, len));
+            p += len + 1;
+        }
+        printf("]");
+        return;
+    }
+
+    for (auto i = 0u ; i < value.size() ; i++) {
+        if (i)
+            printf(", ");
+
+        if (value.type == atoms.float_atom && value.format == 32) {
+            auto f = value.get_float(i);
+            if (std::isfinite(f))
+                printf("%.9g", f);
+            else
+                printf("null");
+        } else if (value.type == XA_INTEGER) {
+            printf("%ld", value.get_long(i));
+        } else if (value.type == XA_CARDINAL) {
+            printf("%lu", value.get_ulong(i));
+        } else if (value.type == XA_ATOM && value.format == 32) {
+            auto a = value.get_atom(i);
+            if (a)
+                json_string(atoms.name(a));
+            else
+                printf("null");
+        } else {
+            printf("null");
+        }
+    }
+    printf("]");
+}
+
+/*
+ * Print the devices and their properties; each device is printed as soon
+ * as its properties are fetched. 'format' is "text", "json" or "ndjson";
+ * 'filter' (if not empty) is the list of the properties to fetch.
+ */
+static int list_devices(Display *display, const std::string &format,
+                        const std::vector<std::string> &filter) {
     XInputTouch xi(display);
+    auto &atoms = XAtoms::get(display);
+
+    std::vector<XInputTouch::XDevInfo> ret;
+    auto nr_touch = xi.find_touch(ret);
+
+    if (format == "json" || format == "ndjson") {
+        bool ndjson = format == "ndjson";
+        bool first = true;
+
+        if (!ndjson)
+            printf("[\n");
+        for (auto &dev: xi.snapshot()->devices()) {
+            std::map<std::string, XPropData> props;
+            xi.list_props(dev.id, props, filter);
+
+            if (!ndjson)
+                printf("%s  ", first ? "" : ",\n");
+            first = false;
+
+            printf("{\"id\": %llu, \"name\": ", (unsigned long long)dev.id);
+            json_string(dev.name);
+            printf(", \"type\": ");
+            json_string(dev.type_str);
+            printf(", \"default\": %s",
+                   nr_touch == 1 && ret[0].id == dev.id ? "true" : "false");
+            printf(", \"properties\": {");
+            bool first_prop = true;
+            for (auto && it2 : props) {
+                if (!first_prop)
+                    printf(", ");
+                first_prop = false;
+                json_string(it2.first);
+                printf(": ");
+                json_value(atoms, it2.second);
+            }
+            printf("}}");
+            if (ndjson)
+                printf("\n");
+            fflush(stdout);
+        }
+        if (!ndjson)
+            printf("%s]\n", first ? "" : "\n");
+        return 0;
+    }
 
-    for (auto &dev: xi.list_devices()) {
+    for (auto &dev: xi.snapshot()->devices()) {
         std::map<std::string, std::vector<std::string>> props;
         printf("%3llu: %s\n", (unsigned long long)dev.id, dev.name.c_str());
         printf("\tType: %s\n", dev.type_str.c_str());
-        xi.list_props(dev.id, props);
+        xi.list_props(dev.id, props, filter);
         for (auto && it2 : props) {
             printf("\t%s: ", it2.first.c_str());
             for (auto i = 0u ; i < it2.second.size() ; i++) {
@@ -111,11 +351,10 @@ static int list_devices(Display *display) {
             }
             printf("\n");
         }
-
+        fflush(stdout);
     }
 
-    std::vector<XInputTouch::XDevInfo> ret;
-    if (xi.find_touch(ret) != 1) {
+    if (nr_touch != 1) {
         printf("\n");
         print_device_not_found(ret);
     } else {
@@ -137,16 +376,32 @@ int main(int argc, char** argv)
     std::string device_name;
     XID device_id = (XID)-1;
     bool show_matrix = false;
+    bool show_stats = false;
+    bool show_latency = false;
     bool show_conf_x11 = false;
     bool show_conf_xinput = false;
     bool show_conf_udev_libinput = false;
     bool not_save = false;
     int monitor_nr = 0;
+    CalibrationGrid grid;
+    bool robust = false;
+    int max_samples = 1;
+    bool use_xi2 = false;
+    double sample_threshold = 1.0;
     std::string start_coeff;
     std::string matrix_name;
     std::string DisplayName = "";
     Display *display;
     bool start_list_devices = false;
+    std::string list_format = "text";
+    std::vector<std::string> list_filter;
+    bool start_daemon = false;
+    bool start_apply = false;
+    auto watch = CalibrationDaemon::WATCH_NONE;
+    std::string fleet_file;
+    int fleet_jobs = 0;
+    std::string solve_from;
+    std::vector<CalibrateTarget> calibrate_targets;
 
     if (getenv("DISPLAY"))
         DisplayName = getenv("DISPLAY");
@@ -166,6 +421,18 @@ int main(int argc, char** argv)
                 monitor_nr = -1;
             else
                 monitor_nr = stoi(opt);
+        } else if (starts_with(arg, "--calibrate=")) {
+            if (!parse_calibrate_list(arg.substr(12), calibrate_targets)) {
+                printf("ERROR: wrong list '%s'\n", arg.substr(12).c_str());
+                exit(1);
+            }
+        } else if (starts_with(arg, "--grid=")) {
+            if (!grid.parse(arg.substr(7).c_str())) {
+                printf("ERROR: wrong grid '%s'\n", arg.substr(7).c_str());
+                exit(1);
+            }
+        } else if (starts_with(arg, "--grid-inset=")) {
+            grid.inset = atof(arg.substr(13).c_str());
         } else if (starts_with(arg, "--threshold-misclick=")) {
             thr_misclick = stoi(arg.substr(21));
         } else if (starts_with(arg, "--threshold-doubleclick=")) {
@@ -178,6 +445,14 @@ int main(int argc, char** argv)
             DisplayName = std::string(arg.substr(10));
         } else if (starts_with(arg, "--device-id=")) {
             device_id = stou(arg.substr(12));
+        } else if (starts_with(arg, "--samples=")) {
+            max_samples = stoi(arg.substr(10));
+        } else if (starts_with(arg, "--sample-threshold=")) {
+            sample_threshold = atof(arg.substr(19).c_str());
+        } else if (arg == "--xi2") {
+            use_xi2 = true;
+        } else if (arg == "--robust") {
+            robust = true;
         } else if (arg == "--verbose") {
             verbose = true;
         } else if (arg == "--dont-save") {
@@ -190,10 +465,50 @@ int main(int argc, char** argv)
             show_conf_udev_libinput = true;
         } else if (arg == "--show-matrix") {
             show_matrix = true;
+        } else if (arg == "--show-stats") {
+            show_stats = true;
+        } else if (arg == "--stats") {
+            show_latency = true;
         } else if (starts_with(arg, "--start-matrix=")) {
             start_coeff = arg.substr(15);
         } else if (arg == "--list-devices") {
             start_list_devices = true;
+        } else if (starts_with(arg, "--format=")) {
+            list_format = arg.substr(9);
+            if (list_format != "text" && list_format != "json" &&
+                    list_format != "ndjson") {
+                printf("ERROR: unknown format '%s'\n", list_format.c_str());
+                exit(1);
+            }
+        } else if (starts_with(arg, "--props=")) {
+            std::string props = arg.substr(8);
+            size_t pos;
+            while ((pos = props.find(',')) != std::string::npos) {
+                list_filter.push_back(props.substr(0, pos));
+                props = props.substr(pos + 1);
+            }
+            list_filter.push_back(props);
+        } else if (starts_with(arg, "--fleet=")) {
+            fleet_file = arg.substr(8);
+        } else if (starts_with(arg, "--solve-from=")) {
+            solve_from = arg.substr(13);
+        } else if (starts_with(arg, "--fleet-jobs=")) {
+            fleet_jobs = stoi(arg.substr(13));
+        } else if (arg == "--daemon") {
+            start_daemon = true;
+        } else if (arg == "--apply") {
+            start_apply = true;
+        } else if (starts_with(arg, "--watch=")) {
+            auto opt = arg.substr(8);
+            if (opt == "log") {
+                watch = CalibrationDaemon::WATCH_LOG;
+            } else if (opt == "revert") {
+                watch = CalibrationDaemon::WATCH_REVERT;
+            } else {
+                printf("ERROR: unknown watch mode '%s'\n", opt.c_str());
+                exit(1);
+            }
+            start_daemon = true;
         } else if (arg == "--help" || arg == "-h") {
             show_help();
             exit(0);
@@ -204,6 +519,67 @@ int main(int argc, char** argv)
         }
     }
 
+    /*
+     * the raw coordinates are the ones before the calibration matrix: the
+     * result is right only if the matrix active during the calibration is
+     * the prescale one
+     */
+    if (use_xi2 && start_coeff.size()) {
+        printf("ERROR: --xi2 and --start-matrix are incompatible\n");
+        exit(1);
+    }
+
+    // the files would be overwritten by each device
+    if (calibrate_targets.size() > 1 && (output_file_x11.size() ||
+            output_file_xinput.size() || output_file_udev_libinput.size())) {
+        printf("ERROR: --calibrate with more devices and --output-file-* are incompatible\n");
+        exit(1);
+    }
+
+    if (!grid.valid()) {
+        printf("ERROR: the grid needs at least 2x2 targets and an inset < 0.5\n");
+        exit(1);
+    }
+
+    if (solve_from.size()) {
+        Mat9 start = Mat9::identity_matrix();
+        if (start_coeff.size() && !mat9_parse(start_coeff.c_str(), start)) {
+            fprintf(stderr, "ERROR: wrong matrix; abort\n");
+            exit(1);
+        }
+
+        int outputs = 0;
+        if (show_matrix)
+            outputs |= SOLVE_SHOW_MATRIX;
+        if (show_conf_x11)
+            outputs |= SOLVE_SHOW_X11;
+        if (show_conf_xinput)
+            outputs |= SOLVE_SHOW_XINPUT;
+        if (show_conf_udev_libinput)
+            outputs |= SOLVE_SHOW_UDEV;
+        if (!outputs)
+            outputs = SOLVE_SHOW_MATRIX;
+        if (show_stats)
+            outputs |= SOLVE_SHOW_STATS;
+
+        double huber_k = 0;
+        if (robust)
+            huber_k = (thr_misclick > 0 ? thr_misclick :
+                       Calibrator::default_threshold_outlier) / 2.0;
+
+        auto ret = run_solve_from(solve_from, start,
+                    matrix_name.size() ? matrix_name : LICALMATR,
+                    outputs, huber_k, verbose);
+        return ret == 0 ? 0 : 1;
+    }
+
+    if (fleet_file.size()) {
+        std::vector<FleetJob> jobs;
+        if (!read_fleet_file(fleet_file, jobs))
+            exit(1);
+        return run_fleet(jobs, device_name, matrix_name, fleet_jobs, verbose);
+    }
+
     if (DisplayName == "") {
         fprintf(stderr, "ERROR: cannot find a valid DISPLAY to open\n");
         exit(1);
@@ -215,197 +591,357 @@ int main(int argc, char** argv)
     }
 
     if (start_list_devices)
-        return list_devices(display);
+        return list_devices(display, list_format, list_filter);
 
     XInputTouch xinputtouch(display);
 
-    if (device_id == (XID)-1 && device_name == "") {
-        std::vector<XInputTouch::XDevInfo>  ret;
-        if (xinputtouch.find_touch(ret) != 1) {
-            print_device_not_found(ret);
-            exit(100);
+    if (start_apply) {
+        Mat9 coeff;
+        if (!mat9_parse(start_coeff.c_str(), coeff)) {
+            fprintf(stderr, "ERROR: --apply requires a valid --start-matrix\n");
+            exit(1);
         }
 
-        device_name = ret[0].name;
-        device_id = ret[0].id;
-    } else {
-        // search a device
-        const auto res = xinputtouch.list_devices();
-        if (res.size() == 0) {
-            fprintf(stderr, "ERROR: Unable to find device\n");
-            exit(100);
-        }
+        LatencyStats latency;
+        bool ok = false;
+        {
+            LatencyScope scope(show_latency ? &latency : nullptr, display, "apply");
+
+            /*
+             * With the id and the matrix name there is nothing to look up:
+             * the device list is not read at all, and the Calibrator checks
+             * that the property is there
+             */
+            if (device_id == (XID)-1 || matrix_name == "") {
+                std::vector<XInputTouch::XDevInfo>  candidates;
+                auto r = xinputtouch.resolve_device(device_id, device_name,
+                                                    candidates);
+                if (r == -1) {
+                    print_device_not_found(candidates);
+                    exit(100);
+                } else if (r < 0) {
+                    fprintf(stderr, "ERROR: Unable to find device\n");
+                    exit(100);
+                }
+                if (xinputtouch.resolve_matrix(device_id, matrix_name) < 0) {
+                    fprintf(stderr, "ERROR: Unable to find a suitable calibration matrix\n");
+                    exit(100);
+                }
+            }
 
-        for( auto &dev: res) {
-            if (device_id != (XID)-1 && device_id == (XID)dev.id) {
-                device_name = dev.name;
-                break;
-            } else if (device_name == dev.name) {
-                device_id = dev.id;
-                break;
+            // an id not looked up may be wrong: BadDevice must not be fatal
+            auto old_handler = XSetErrorHandler(apply_error_handler);
+            try {
+                Calibrator calib(display, device_name, device_id, 0, 0,
+                                 matrix_name, verbose, &xinputtouch);
+                ok = calib.apply_calibration(coeff);
+            } catch (const WrongCalibratorException &e) {
+                fprintf(stderr, "ERROR: %s\n", e.what());
             }
-        }
-    }
+            XSetErrorHandler(old_handler);
 
-    if (device_id == (XID)-1 || device_name == "")  {
-        fprintf(stderr, "ERROR: Unable to find device\n");
-        exit(100);
-    }
+            if (apply_x_error) {
+                fprintf(stderr, "ERROR: Unable to access the device %lu (X error %d)\n",
+                        device_id, apply_x_error);
+                ok = false;
+            }
+        }
 
-    if (verbose) {
-        printf("device-id:                         %lu\n", device_id);
-        printf("device-name:                       '%s'\n", device_name.c_str());
+        if (show_latency)
+            latency.print();
+        return ok ? 0 : 1;
     }
 
-    // find a suitable calibration matrix
-    std::map<std::string, std::vector<std::string>> lprops;
-    if (xinputtouch.list_props(device_id, lprops) < 0) {
-        fprintf(stderr, "ERROR: Unable to get the device properties\n");
-        exit(100);
-    }
+    if (start_daemon) {
+        Mat9 coeff;
+        if (!mat9_parse(start_coeff.c_str(), coeff)) {
+            fprintf(stderr, "ERROR: --daemon requires a valid --start-matrix\n");
+            exit(1);
+        }
 
-    if (matrix_name == "") {
-        for (auto i : lprops) {
-            if (i.first == LICALMATR) {
-                matrix_name = i.first;
-                break;
-            } else if (i.first == XICALMATR && matrix_name == "") {
-                matrix_name = i.first;
-                // no break, continue to search LICALMATR if available
+        // the device ids change when a device is plugged again: use the name
+        if (device_id != (XID)-1) {
+            std::vector<XInputTouch::XDevInfo> candidates;
+            if (xinputtouch.resolve_device(device_id, device_name,
+                                           candidates) < 0) {
+                fprintf(stderr, "ERROR: Unable to find device\n");
+                exit(100);
             }
         }
-    } else {
-        bool found = false;
-        for (auto i : lprops)
-            if (i.first == matrix_name)
-                found = true;
-        if (!found) {
-            fprintf(stderr, "ERROR: Unable to find a suitable calibration matrix\n");
-            exit(100);
-        }
+
+        CalibrationDaemon daemon(display, xinputtouch, device_name,
+                                 matrix_name, coeff, verbose, watch);
+        return daemon.run();
+    }
+
+    // with four targets the inconsistent one can't be found
+    if (robust && grid.size() < 5) {
+        printf("ERROR: --robust needs at least 5 targets (e.g. --grid=3x3)\n");
+        exit(1);
     }
 
-    if (matrix_name == "") {
-        fprintf(stderr, "ERROR: Unable to find a suitable calibration matrix\n");
-        exit(100);
+    if (calibrate_targets.empty()) {
+        CalibrateTarget t;
+        t.device_id = device_id;
+        t.device_name = device_name;
+        t.monitor_nr = monitor_nr;
+        calibrate_targets.push_back(t);
     }
 
     if (verbose) {
         printf("show-matrix:                       %s\n", show_matrix ? "yes" : "no");
+        printf("show-stats:                        %s\n", show_stats ? "yes" : "no");
+        printf("stats:                             %s\n", show_latency ? "yes" : "no");
         printf("show-x11-config:                   %s\n", show_conf_x11 ? "yes" : "no");
         printf("show-libinput-config:              %s\n", show_conf_xinput ? "yes" : "no");
         printf("show-udev-libinput-config:         %s\n", show_conf_udev_libinput ? "yes" : "no");
         printf("not-save:                          %s\n", not_save ? "yes" : "no");
-        printf("matrix-name:                       '%s'\n", matrix_name.c_str());
         printf("output-file-x11-config:            '%s'\n", output_file_x11.c_str());
         printf("output-file-xinput-config:         '%s'\n", output_file_xinput.c_str());
         printf("output-file-udev-libinput-config:  '%s'\n", output_file_udev_libinput.c_str());
         printf("threshold-misclick:                %d\n", thr_misclick);
         printf("threshold-doubleclick:             %d\n", thr_doubleclick);
-        printf("monitor-number:                    %d\n", monitor_nr);
+        printf("robust:                            %s\n", robust ? "yes" : "no");
+        printf("samples:                           %d (threshold %g)\n",
+               max_samples, sample_threshold);
+        printf("xi2:                               %s\n", use_xi2 ? "yes" : "no");
+        printf("grid:                              %dx%d (inset %g)\n",
+               grid.cols, grid.rows, grid.inset);
     }
 
+    Mat9 start;
+    if (start_coeff.size() && !mat9_parse(start_coeff.c_str(), start)) {
+        fprintf(stderr, "ERROR: wrong matrix; abort\n");
+        exit(1);
+    }
 
-    GuiCalibratorX11 gui(display, monitor_nr);
-    Calibrator  calib(display, device_name, device_id, thr_misclick, thr_doubleclick,
-                        matrix_name, verbose);
+    /*
+     * Look up all the devices before touching any matrix: once a
+     * Calibrator exists, the errors have to return from main() (not
+     * exit()) so that its destructor restores the previous matrix
+     */
+    for (auto &target : calibrate_targets) {
+        std::vector<XInputTouch::XDevInfo>  candidates;
+        auto r = xinputtouch.resolve_device(target.device_id,
+                                            target.device_name, candidates);
+        if (r == -1) {
+            print_device_not_found(candidates);
+            exit(100);
+        } else if (r < 0) {
+            fprintf(stderr, "ERROR: Unable to find device\n");
+            exit(100);
+        }
 
-    int monitor_x, monitor_y, monitor_width, monitor_height;
-    int overall_width, overall_height;
-    gui.get_overall_display_size(overall_width, overall_height);
-    gui.get_monitor_size(monitor_x, monitor_y,
-                         monitor_width, monitor_height, monitor_nr);
+        // find a suitable calibration matrix
+        target.matrix_name = matrix_name;
+        if (xinputtouch.resolve_matrix(target.device_id, target.matrix_name) < 0) {
+            fprintf(stderr, "ERROR: Unable to find a suitable calibration matrix\n");
+            exit(100);
+        }
 
-    if(verbose) {
-	    printf("Calibrating for monitor size %d, %d at %d, %d on overall display of %d, %d\n",
-                monitor_width, monitor_height, monitor_x, monitor_y, overall_width, overall_height);
+        /*
+         * a second Calibrator would save the prescale matrix of the first
+         * one as the "previous" matrix, and restore it on failure
+         */
+        for (auto &other : calibrate_targets) {
+            if (&other == &target)
+                break;
+            if (other.device_id == target.device_id) {
+                fprintf(stderr, "ERROR: device %lu listed more than once in --calibrate\n",
+                        target.device_id);
+                exit(1);
+            }
+        }
     }
 
-    if (start_coeff.size() == 0) {
-        /* When multiple monitors are attached X translates the incoming clicks
-         * to cover the whole display area across all monitors. This causes real
-         * problems if the overall display isn't rectangular, such as when 2
-         * monitors are different resolutions. In this case X11 won't generate a click
-         * off the monitors, instead moving it to the nearest pixel (in the X direction?)
-         * which is on a monitor. This means that if you have a 1024x768 monitor to the
-         * left of a 1920x1080 monitor, all clicks in the bottom-left corner will
-         * actually come in as clicks with an X co-ordinate of 1024 (the start of the
-         * taller 1920x1080 monitor).
-         *
-         * To prevent this problem, we must first translate and scale the whole
-         * co-ordinate space of the overall display width/height, into the co-ordinate
-         * space of the monitor we're drawing our window on, that way all clicks will
-         * be scaled to values X11 will actually return to our program.
+    LatencyStats latency;
+
+    /*
+     * Calibrate a device with the targets on a monitor: on success the
+     * result is computed but not applied yet
+     */
+    auto calibrate = [&](GuiCalibratorX11 &gui, Calibrator &calib,
+                         XID device_id, int monitor_nr) -> bool {
+        calib.set_grid(grid);
+        calib.set_robust(robust);
+
+        /*
+         * The geometry comes from the monitor layout cached by the gui:
+         * when it changes, the start matrix is computed again and the
+         * calibration restarts
          */
-        Mat9 prescale = Mat9::translate_matrix((float)monitor_x/overall_width,
-                                               (float)monitor_y/overall_height) *
-                        Mat9::scale_matrix((float)monitor_width/overall_width,
-                                           (float)monitor_height/overall_height);
+        int monitor_x, monitor_y, monitor_width, monitor_height;
+        int overall_width, overall_height;
+        auto set_start_matrix = [&]() {
+            gui.get_overall_display_size(overall_width, overall_height);
+            gui.get_monitor_size(monitor_x, monitor_y,
+                                 monitor_width, monitor_height, monitor_nr);
+
+            if(verbose) {
+                printf("Calibrating for monitor size %d, %d at %d, %d on overall display of %d, %d\n",
+                        monitor_width, monitor_height, monitor_x, monitor_y, overall_width, overall_height);
+            }
 
+            if (start_coeff.size() == 0) {
+                /* When multiple monitors are attached X translates the incoming clicks
+                 * to cover the whole display area across all monitors. This causes real
+                 * problems if the overall display isn't rectangular, such as when 2
+                 * monitors are different resolutions. In this case X11 won't generate a click
+                 * off the monitors, instead moving it to the nearest pixel (in the X direction?)
+                 * which is on a monitor. This means that if you have a 1024x768 monitor to the
+                 * left of a 1920x1080 monitor, all clicks in the bottom-left corner will
+                 * actually come in as clicks with an X co-ordinate of 1024 (the start of the
+                 * taller 1920x1080 monitor).
+                 *
+                 * To prevent this problem, we must first translate and scale the whole
+                 * co-ordinate space of the overall display width/height, into the co-ordinate
+                 * space of the monitor we're drawing our window on, that way all clicks will
+                 * be scaled to values X11 will actually return to our program.
+                 */
+                Mat9 prescale = Mat9::translate_matrix((float)monitor_x/overall_width,
+                                                       (float)monitor_y/overall_height) *
+                                Mat9::scale_matrix((float)monitor_width/overall_width,
+                                                   (float)monitor_height/overall_height);
+
+
+                if(verbose) {
+                    printf("Prescaled for multi-monitors: %f,%f,%f,%f\n",prescale[0],prescale[4],prescale[2],prescale[5]);
+                }
+
+                calib.set_calibration(prescale);
+
+            } else {
+                calib.set_calibration(start);
+            }
+        };
+        set_start_matrix();
+        gui.set_layout_change(set_start_matrix);
 
-        if(verbose) {
-            printf("Prescaled for multi-monitors: %f,%f,%f,%f\n",prescale[0],prescale[4],prescale[2],prescale[5]);
+        if (use_xi2 && !gui.enable_xi2(device_id)) {
+            fprintf(stderr, "ERROR: unable to use XInput 2 for the device\n");
+            return false;
         }
 
-        calib.set_calibration(prescale);
+        gui.set_sampling(max_samples, sample_threshold);
+        gui.set_add_click([&](double x, double y) -> bool{
+            return calib.add_click(x, y);
+        });
+        gui.set_reset([&](){
+            return calib.reset();
+        });
+        gui.set_robust(robust);
+        if (robust) {
+            gui.set_find_outlier([&]() -> int {
+                return calib.find_outlier(monitor_width, monitor_height);
+            });
+            gui.set_replace_click([&](int i, double x, double y) -> bool {
+                return calib.replace_click(i, x, y);
+            });
+        }
 
-    } else {
-        Mat9 coeff;
-        auto nr = sscanf(start_coeff.c_str(), "%f,%f,%f,%f,%f,%f,%f,%f,%f",
-            &coeff.coeff[0], &coeff.coeff[1], &coeff.coeff[2],
-            &coeff.coeff[3], &coeff.coeff[4], &coeff.coeff[5],
-            &coeff.coeff[6], &coeff.coeff[7], &coeff.coeff[8]);
-        if (nr == 9) {
-            calib.set_calibration(coeff);
-        } else {
-            fprintf(stderr, "ERROR: wrong matrix; abort\n");
-            exit(1);
+        if (show_latency)
+            gui.set_latency_stats(&latency);
+
+        // wait for timer signal, processes events
+        auto ret = gui.mainloop();
+
+        if (verbose) {
+            auto &ds = gui.get_draw_stats();
+            printf("Drawing: %lu frames, %lu X requests (max %lu per frame)\n",
+                   ds.frames, ds.requests, ds.max_requests);
         }
-    }
 
-    gui.set_add_click([&](int x, int y) -> bool{
-        return calib.add_click(x, y);
-    });
-    gui.set_reset([&](){
-        return calib.reset();
-    });
+        if (!ret) {
+            printf("No results.. exit\n");
+            return false;
+        }
 
-    // wait for timer signal, processes events
-    auto ret = gui.mainloop();
+        if (verbose) {
+            printf("Click points accepted:\n");
+            for(int i = 0 ; i < calib.get_numclicks() ; i++) {
+                auto [x, y] = calib.get_point(i);
+                printf("\tx=%.1f, y=%.1f\n", x, y);
+            }
+        }
 
-    if (!ret) {
-        printf("No results.. exit\n");
-        return 1;
-    }
+        LatencyScope scope(show_latency ? &latency : nullptr, display, "finish");
+        if (!calib.finish(monitor_width, monitor_height)) {
+            printf("No results.. exit\n");
+            return false;
+        }
 
-    if (verbose) {
-        printf("Click points accepted:\n");
-        for(int i = 0 ; i < calib.get_numclicks() ; i++) {
-            auto [x, y] = calib.get_point(i);
-            printf("\tx=%d, y=%d\n", x, y);
+        return true;
+    };
+
+    /*
+     * The window, the font, the GC and the XInput state are shared by all
+     * the devices; the previous matrices are restored if any calibration
+     * fails
+     */
+    std::unique_ptr<GuiCalibratorX11> gui;
+    std::vector<std::unique_ptr<Calibrator>> calibs;
+
+    for (auto &target : calibrate_targets) {
+        if (verbose) {
+            printf("device-id:                         %lu\n", target.device_id);
+            printf("device-name:                       '%s'\n", target.device_name.c_str());
+            printf("matrix-name:                       '%s'\n", target.matrix_name.c_str());
+            printf("monitor-number:                    %d\n", target.monitor_nr);
+        }
+
+        if (!gui)
+            gui.reset(new GuiCalibratorX11(display, target.monitor_nr, grid));
+        else
+            gui->set_monitor(target.monitor_nr);
+
+        try {
+            calibs.emplace_back(new Calibrator(display, target.device_name,
+                                               target.device_id,
+                                               thr_misclick, thr_doubleclick,
+                                               target.matrix_name, verbose,
+                                               &xinputtouch));
+        } catch (const WrongCalibratorException &e) {
+            fprintf(stderr, "ERROR: %s\n", e.what());
+            return 1;
         }
+        if (!calibrate(*gui, *calibs.back(), target.device_id,
+                       target.monitor_nr))
+            return 1;
     }
+    gui.reset();
 
-    calib.finish(monitor_width, monitor_height);
+    for (auto &calib : calibs) {
+        if (show_matrix) {
+            auto coeff = calib->get_coeff();
+            printf("Calibration matrix:\n");
+            mat9_print(coeff);
+        }
 
-    if (show_matrix) {
-        auto coeff = calib.get_coeff();
-        printf("Calibration matrix:\n");
-        mat9_print(coeff);
+        if (show_stats)
+            output_stats(calib->get_device_name(), calib->get_stats());
     }
 
+    // all the matrices are written, then a single round trip
     if (!not_save) {
         if (verbose)
             printf("Update the X11 calibration matrix\n");
-        calib.save_calibration();
+        LatencyScope scope(show_latency ? &latency : nullptr, display, "save");
+        for (auto &calib : calibs)
+            calib->save_calibration(false);
+        XSync(display, False);
     }
 
-    if (show_conf_x11 || output_file_x11.size())
-        calib.output_xorgconfd(output_file_x11);
-    if (show_conf_xinput || output_file_xinput.size())
-        calib.output_xinput(output_file_xinput);
-    if (show_conf_udev_libinput || output_file_udev_libinput.size())
-        calib.output_udev_libinput(output_file_udev_libinput);
+    if (show_latency)
+        latency.print();
+
+    for (auto &calib : calibs) {
+        if (show_conf_x11 || output_file_x11.size())
+            calib->output_xorgconfd(output_file_x11);
+        if (show_conf_xinput || output_file_xinput.size())
+            calib->output_xinput(output_file_xinput);
+        if (show_conf_udev_libinput || output_file_udev_libinput.size())
+            calib->output_udev_libinput(output_file_udev_libinput);
+    }
 
     return 0;
 }
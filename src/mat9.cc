@@ -22,149 +22,259 @@
 
 #include <cstdio>
 #include <cstring>
+#include <cmath>
+#include <tuple>
 
 #include "mat9.hpp"
 
-void mat9_invert(const Mat9 &m, Mat9 &minv) {
-    /*
-     * from https://stackoverflow.com/questions/983999/simple-3x3-matrix-inverse-code-c
-     * with some simplification
-     */
-    const float m4857 = m[4] * m[8] - m[5] * m[7];
-    const float m3746 = m[3] * m[7] - m[4] * m[6];
-    const float m5638 = m[5] * m[6] - m[3] * m[8];
-    const float det = m[0] * (m4857) +
-                 m[1] * (m5638) +
-                 m[2] * (m3746);
-
-    const float invdet = 1 / det;
-
-    //Matrix33d minv; // inverse of matrix m
-    minv[0] = (m4857) * invdet;
-    minv[1] = (m[2] * m[7] - m[1] * m[8]) * invdet;
-    minv[2] = (m[1] * m[5] - m[2] * m[4]) * invdet;
-    minv[3] = (m5638) * invdet;
-    minv[4] = (m[0] * m[8] - m[2] * m[6]) * invdet;
-    minv[5] = (m[2] * m[3] - m[0] * m[5]) * invdet;
-    minv[6] = (m3746) * invdet;
-    minv[7] = (m[1] * m[6] - m[0] * m[7]) * invdet;
-    minv[8] = (m[0] * m[4] - m[1] * m[3]) * invdet;
-}
-
-void mat9_product(const Mat9 &m1, const Mat9 &m2, Mat9 &m3){
-    int i,j, k;
-    for (i = 0 ; i < 3 ; i++) {
-        for (j = 0 ; j < 3 ; j++) {
-            float sum = 0;
-            for (k = 0 ; k < 3 ; k++)
-                sum += m1[i*3+k]*m2[j+k*3];
-            m3[i*3+j] = sum;
-        }
-    }
-}
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#define MAT9_SIMD 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define MAT9_SIMD 1
+#endif
 
-void mat9_sum(const Mat9 &m1, Mat9 &m2){
+template <typename T>
+void mat9_sum(const Mat3<T> &m1, Mat3<T> &m2){
     int i;
     for (i = 0 ; i < 9 ; i++)
         m2[i] += m1[i];
 }
 
-void mat9_product(const float c, Mat9 &m1){
+template <typename T>
+void mat9_product(const mat3_scalar_t<T> c, Mat3<T> &m1){
     int i;
     for (i = 0 ; i < 9 ; i++)
         m1[i] *= c;
 }
 
-void mat9_print(const Mat9 &m) {
+template <typename T>
+bool mat9_almost_equal(const Mat3<T> &m1, const Mat3<T> &m2, mat3_scalar_t<T> eps) {
+    int i;
+    for (i = 0 ; i < 9 ; i++)
+        if (std::fabs(m1[i] - m2[i]) > eps)
+            return false;
+    return true;
+}
+
+template <typename T>
+void mat9_print(const Mat3<T> &m) {
     int i,j;
     for (i = 0 ; i < 3 ; i++ ) {
         printf("\t[");
         for (j = 0 ; j < 3 ; j++) {
             if (j != 0)
                 printf(", ");
-            printf("%f", m[i*3+j]);
+            printf("%f", (double)m[i*3+j]);
         }
         printf("]\n");
     }
 }
 
-void mat9_set_identity(Mat9 &m) {
-    static const float id[] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
-    memcpy(m.coeff, id, sizeof(m.coeff));
-}
-
-void mat9_set_translate(Mat9 &m, float dx, float dy) {
-    float translate[] = {
-        1, 0, dx,
-        0, 1, dy,
-        0, 0, 1
-    };
-    memcpy(m.coeff, translate, sizeof(m.coeff));
-};
+/* parse "x1,x2,...,x9"; return false if the string is not valid */
+template <typename T>
+bool mat9_parse(const char *s, Mat3<T> &m) {
+    long double c[9];
+    auto nr = sscanf(s, "%Lf,%Lf,%Lf,%Lf,%Lf,%Lf,%Lf,%Lf,%Lf",
+        &c[0], &c[1], &c[2], &c[3], &c[4], &c[5], &c[6], &c[7], &c[8]);
+    if (nr != 9)
+        return false;
 
-void mat9_set_scale(Mat9 &m, float sx, float sy) {
-    float scale[] = {
-        sx, 0,  0,
-        0,  sy, 0,
-        0,  0,  1
-    };
-    memcpy(m.coeff, scale, sizeof(m.coeff));
-};
-
-
-Mat9 Mat9::operator *(const Mat9 &other) const {
-    Mat9 res;
-    mat9_product(*this, other, res);
-    return res;
+    for (int i = 0 ; i < 9 ; i++)
+        m[i] = (T)c[i];
+    return true;
 }
-Mat9 & Mat9::operator *=(const Mat9 &other) {
-    Mat9 res = *this;
+
+template <typename T>
+Mat3<T> & Mat3<T>::operator *=(const Mat3 &other) {
+    Mat3 res = *this;
     mat9_product(res, other, *this);
     return *this;
 }
-Mat9 Mat9::operator +(const Mat9 &other) const {
-    Mat9 res = *this;
+template <typename T>
+Mat3<T> Mat3<T>::operator +(const Mat3 &other) const {
+    Mat3 res = *this;
     mat9_sum(other, res);
     return res;
 }
-Mat9 & Mat9::operator +=(const Mat9 &other) {
+template <typename T>
+Mat3<T> & Mat3<T>::operator +=(const Mat3 &other) {
     mat9_sum(other, *this);
     return *this;
 }
 
-Mat9 Mat9::operator *(float other) const {
-    Mat9 res = *this;
+template <typename T>
+Mat3<T> Mat3<T>::operator *(T other) const {
+    Mat3 res = *this;
     mat9_product(other, res);
     return res;
 }
-Mat9 & Mat9::operator *=(float other) {
+template <typename T>
+Mat3<T> & Mat3<T>::operator *=(T other) {
     mat9_product(other, *this);
     return *this;
 }
-Mat9 Mat9::invert() const {
-    Mat9 res;
-    mat9_invert(*this, res);
-    return res;
+
+template <typename T>
+Mat3<T> operator *(mat3_scalar_t<T> lth, const Mat3<T> &rhs) {
+    return rhs * lth;
 }
 
-Mat9 Mat9::identity_matrix() {
-    Mat9 res;
-    mat9_set_identity(res);
-    return res;
+#define MAT3_INSTANTIATE(T) \
+    template struct Mat3<T>; \
+    template void mat9_print(const Mat3<T> &m); \
+    template bool mat9_parse(const char *s, Mat3<T> &m); \
+    template void mat9_sum(const Mat3<T> &m1, Mat3<T> &m2); \
+    template void mat9_product(const T c, Mat3<T> &m1); \
+    template bool mat9_almost_equal(const Mat3<T> &m1, const Mat3<T> &m2, T eps); \
+    template Mat3<T> operator *(T lth, const Mat3<T> &rhs);
+
+MAT3_INSTANTIATE(float)
+MAT3_INSTANTIATE(double)
+MAT3_INSTANTIATE(long double)
+
+#ifdef MAT9_SIMD
+
+/*
+ * 4 floats wide helpers, so the kernels below are written once for SSE
+ * and NEON
+ */
+#if defined(__SSE__)
+typedef __m128 vf4;
+static inline vf4 vf4_set1(float a) { return _mm_set1_ps(a); }
+static inline vf4 vf4_set(float a, float b, float c, float d) { return _mm_setr_ps(a, b, c, d); }
+static inline vf4 vf4_load(const float *p) { return _mm_loadu_ps(p); }
+static inline void vf4_store(float *p, vf4 a) { _mm_storeu_ps(p, a); }
+static inline vf4 vf4_add(vf4 a, vf4 b) { return _mm_add_ps(a, b); }
+static inline vf4 vf4_sub(vf4 a, vf4 b) { return _mm_sub_ps(a, b); }
+static inline vf4 vf4_mul(vf4 a, vf4 b) { return _mm_mul_ps(a, b); }
+static inline vf4 vf4_div(vf4 a, vf4 b) { return _mm_div_ps(a, b); }
+#else
+typedef float32x4_t vf4;
+static inline vf4 vf4_set1(float a) { return vdupq_n_f32(a); }
+static inline vf4 vf4_set(float a, float b, float c, float d) {
+    const float v[4] = {a, b, c, d};
+    return vld1q_f32(v);
+}
+static inline vf4 vf4_load(const float *p) { return vld1q_f32(p); }
+static inline void vf4_store(float *p, vf4 a) { vst1q_f32(p, a); }
+static inline vf4 vf4_add(vf4 a, vf4 b) { return vaddq_f32(a, b); }
+static inline vf4 vf4_sub(vf4 a, vf4 b) { return vsubq_f32(a, b); }
+static inline vf4 vf4_mul(vf4 a, vf4 b) { return vmulq_f32(a, b); }
+static inline vf4 vf4_div(vf4 a, vf4 b) { return vdivq_f32(a, b); }
+#endif
+
+void mat9_product_simd(const Mat9 &m1, const Mat9 &m2, Mat9 &m3) {
+    const float *a = m1.coeff, *b = m2.coeff;
+    // the rows of m2, padded to 4
+    const vf4 b0 = vf4_set(b[0], b[1], b[2], 0);
+    const vf4 b1 = vf4_set(b[3], b[4], b[5], 0);
+    const vf4 b2 = vf4_set(b[6], b[7], b[8], 0);
+    float r[12];
+
+    // row i of m3 = a[i,0] * row 0 + a[i,1] * row 1 + a[i,2] * row 2
+    for (int i = 0 ; i < 3 ; i++) {
+        vf4 row = vf4_add(vf4_add(vf4_mul(vf4_set1(a[i*3]), b0),
+                                  vf4_mul(vf4_set1(a[i*3+1]), b1)),
+                          vf4_mul(vf4_set1(a[i*3+2]), b2));
+        vf4_store(r + i*4, row);
+    }
+
+    m3.set(r[0], r[1], r[2], r[4], r[5], r[6], r[8], r[9], r[10]);
+}
+
+void mat9_invert_batch(const Mat9 *mat, Mat9 *minv, int n) {
+    int i = 0;
+
+    // four matrices at time: the lane 'l' of m[k] is the coeff 'k' of mat[i+l]
+    for ( ; i + 4 <= n ; i += 4) {
+        vf4 m[9];
+        for (int k = 0 ; k < 9 ; k++)
+            m[k] = vf4_set(mat[i].coeff[k], mat[i+1].coeff[k],
+                           mat[i+2].coeff[k], mat[i+3].coeff[k]);
+
+        auto cross = [](vf4 a, vf4 b, vf4 c, vf4 d) {
+            return vf4_sub(vf4_mul(a, b), vf4_mul(c, d));
+        };
+
+        const vf4 m4857 = cross(m[4], m[8], m[5], m[7]);
+        const vf4 m3746 = cross(m[3], m[7], m[4], m[6]);
+        const vf4 m5638 = cross(m[5], m[6], m[3], m[8]);
+        const vf4 det = vf4_add(vf4_add(vf4_mul(m[0], m4857),
+                                        vf4_mul(m[1], m5638)),
+                                vf4_mul(m[2], m3746));
+        const vf4 invdet = vf4_div(vf4_set1(1), det);
+
+        const vf4 r[9] = {
+            vf4_mul(m4857, invdet),
+            vf4_mul(cross(m[2], m[7], m[1], m[8]), invdet),
+            vf4_mul(cross(m[1], m[5], m[2], m[4]), invdet),
+            vf4_mul(m5638, invdet),
+            vf4_mul(cross(m[0], m[8], m[2], m[6]), invdet),
+            vf4_mul(cross(m[2], m[3], m[0], m[5]), invdet),
+            vf4_mul(m3746, invdet),
+            vf4_mul(cross(m[1], m[6], m[0], m[7]), invdet),
+            vf4_mul(cross(m[0], m[4], m[1], m[3]), invdet),
+        };
+
+        float out[9][4];
+        for (int k = 0 ; k < 9 ; k++)
+            vf4_store(out[k], r[k]);
+        for (int l = 0 ; l < 4 ; l++)
+            for (int k = 0 ; k < 9 ; k++)
+                minv[i+l].coeff[k] = out[k][l];
+    }
+
+    for ( ; i < n ; i++)
+        mat9_invert(mat[i], minv[i]);
 }
-Mat9 Mat9::translate_matrix(float dx, float dy) {
-    Mat9 res;
-    mat9_set_translate(res, dx, dy);
-    return res;
+
+void mat9_transform(const Mat9 &m, const float *xs, const float *ys,
+                    float *ox, float *oy, size_t n) {
+    const vf4 a = vf4_set1(m[0]), b = vf4_set1(m[1]), c = vf4_set1(m[2]);
+    const vf4 d = vf4_set1(m[3]), e = vf4_set1(m[4]), f = vf4_set1(m[5]);
+    size_t i = 0;
+
+    for ( ; i + 4 <= n ; i += 4) {
+        const vf4 x = vf4_load(xs + i), y = vf4_load(ys + i);
+        vf4_store(ox + i, vf4_add(vf4_add(vf4_mul(a, x), vf4_mul(b, y)), c));
+        vf4_store(oy + i, vf4_add(vf4_add(vf4_mul(d, x), vf4_mul(e, y)), f));
+    }
+
+    for ( ; i < n ; i++)
+        std::tie(ox[i], oy[i]) = m.apply(xs[i], ys[i]);
 }
-Mat9 Mat9::scale_matrix(float sx, float sy) {
-    Mat9 res;
-    mat9_set_scale(res, sx, sy);
-    return res;
+
+#else
+
+void mat9_product_simd(const Mat9 &m1, const Mat9 &m2, Mat9 &m3) {
+    mat9_product(m1, m2, m3);
 }
 
-Mat9 operator *(float lth, const Mat9 &rhs) {
-    return rhs * lth;
+void mat9_invert_batch(const Mat9 *mat, Mat9 *minv, int n) {
+    for (int i = 0 ; i < n ; i++)
+        mat9_invert(mat[i], minv[i]);
+}
+
+void mat9_transform(const Mat9 &m, const float *xs, const float *ys,
+                    float *ox, float *oy, size_t n) {
+    for (size_t i = 0 ; i < n ; i++)
+        std::tie(ox[i], oy[i]) = m.apply(xs[i], ys[i]);
+}
+
+#endif
+
+/*
+ * Apply the libinput matrix 'cn' to points in screen coordinates: the
+ * normalization is folded in the matrix, so the cost is the same as
+ * mat9_transform()
+ */
+void mat9_transform_normalized(const Mat9 &cn, int width, int height,
+                    const float *xs, const float *ys,
+                    float *ox, float *oy, size_t n) {
+    const Mat9 c(mat9_denormalize(Mat3d(cn), width, height));
+    mat9_transform(c, xs, ys, ox, oy, n);
 }
 
 #ifdef TEST_MAT9
@@ -408,6 +518,125 @@ void test_Mat9_operator_sum() {
     assert(out == mat1);
 }
 
+void test_mat9_almost_equal() {
+    Mat9 mat1(4, 5, 6, 7, 8, 10, 11, 13, 19);
+    Mat9 mat2 = mat1;
+
+    mat2[3] += 1e-4;
+    assert(mat9_almost_equal(mat1, mat2, 1e-3));
+    assert(!mat9_almost_equal(mat1, mat2, 1e-5));
+    assert(mat1.almost_equal(mat2, 1e-3));
+}
+
+void test_mat9_parse() {
+    Mat9 mat;
+
+    assert(mat9_parse("1,2,3,4,5,6,7,8,9.5", mat));
+    assert(mat == Mat9(1, 2, 3, 4, 5, 6, 7, 8, 9.5));
+
+    assert(!mat9_parse("1,2,3,4,5,6,7,8", mat));
+    assert(!mat9_parse("", mat));
+    assert(mat == Mat9(1, 2, 3, 4, 5, 6, 7, 8, 9.5));
+}
+
+void test_Mat3_double() {
+    // a "touch" matrix built from 4K pixel coordinates
+    Mat3d m(240, 3599, 240, 135, 135, 2024, 1, 1, 1);
+    Mat3d res = m * m.invert();
+
+    assert(res.almost_equal(Mat3d::identity_matrix(), 1e-12));
+    assert(4.0 * Mat3d::identity_matrix() == Mat3d::identity_matrix() * 4);
+}
+
+void test_Mat3_convert() {
+    Mat3d md(1.0/3, 2, 3, 4, 5, 6, 7, 8, 9);
+    Mat9 mf(md);
+    Mat3ld ml(md);
+
+    assert(mf[0] == (float)(1.0/3));
+    assert(ml[0] == (long double)(1.0/3));
+    assert(Mat3d(mf).almost_equal(md, 1e-7));
+
+    assert(mat9_parse("0.1,2,3,4,5,6,7,8,9", md));
+    assert(md[0] == 0.1);
+}
+
+void test_Mat3_constexpr() {
+    constexpr Mat3d m = Mat3d::translate_matrix(4, 5) * Mat3d::scale_matrix(7, 8);
+    static_assert(m[0] == 7 && m[2] == 4 && m[4] == 8 && m[5] == 5);
+
+    constexpr Mat3d mi = m.invert();
+    static_assert(mi[0] == 1.0 / 7 && mi[8] == 1);
+}
+
+void test_mat9_product_simd() {
+    Mat9 m1(1.5, 2, -3, 4, 5.25, 6, 7, 8, 9.5);
+    Mat9 m2(0.5, -1, 2, 3, 4, 0.125, 6, 7, 8);
+    Mat9 out1, out2;
+
+    mat9_product(m1, m2, out1);
+    mat9_product_simd(m1, m2, out2);
+    assert(out1 == out2);
+
+    mat9_product_simd(m1, m2, m1);
+    assert(out1 == m1);
+}
+
+void test_mat9_invert_batch() {
+    Mat9 in[7], out[7], ref;
+
+    for (int i = 0 ; i < 7 ; i++)
+        in[i] = Mat9::translate_matrix(i, 2 * i) * Mat9::scale_matrix(i + 1, 3);
+    mat9_invert_batch(in, out, 7);
+
+    for (int i = 0 ; i < 7 ; i++) {
+        mat9_invert(in[i], ref);
+        assert(out[i].almost_equal(ref, 1e-6));
+    }
+}
+
+void test_Mat9_apply() {
+    constexpr Mat9 m = Mat9::translate_matrix(4, 5) * Mat9::scale_matrix(2, 3);
+    constexpr auto p = m.apply(10, 20);
+    static_assert(p.first == 24 && p.second == 65);
+}
+
+void test_mat9_transform() {
+    const int n = 13;
+    const Mat9 m(1.5, 0.25, -3, -0.5, 2, 6, 0, 0, 1);
+    float xs[n], ys[n], ox[n], oy[n];
+
+    for (int i = 0 ; i < n ; i++) {
+        xs[i] = i * 10.5;
+        ys[i] = 100 - i * 3;
+    }
+    mat9_transform(m, xs, ys, ox, oy, n);
+
+    for (int i = 0 ; i < n ; i++) {
+        auto [x, y] = m.apply(xs[i], ys[i]);
+        assert(ox[i] == x && oy[i] == y);
+    }
+}
+
+void test_mat9_transform_normalized() {
+    const int n = 5;
+    // screen matrix -> libinput matrix -> screen matrix
+    const Mat3d c(1.02, 0.01, -15, -0.02, 0.98, 8, 0, 0, 1);
+    const Mat3d cn = mat9_normalize(c, 1920, 1080);
+    assert(mat9_denormalize(cn, 1920, 1080).almost_equal(c, 1e-9));
+    assert(cn[2] == -15.0 / 1920 && cn[5] == 8.0 / 1080);
+
+    float xs[n] = {0, 100, 960, 1800, 1919};
+    float ys[n] = {0, 50, 540, 1000, 1079};
+    float ox[n], oy[n];
+    mat9_transform_normalized(Mat9(cn), 1920, 1080, xs, ys, ox, oy, n);
+
+    for (int i = 0 ; i < n ; i++) {
+        auto [x, y] = c.apply(xs[i], ys[i]);
+        assert(std::fabs(ox[i] - x) < 1e-3 && std::fabs(oy[i] - y) < 1e-3);
+    }
+}
+
 #define TEST(x) \
     fprintf(stderr, "Start test " #x "... "); \
     x(); \
@@ -421,6 +650,8 @@ int main(int argc, char **argv) {
     TEST(test_mat9_product_scalar);
     TEST(test_mat9_product);
     TEST(test_mat9_invert);
+    TEST(test_mat9_almost_equal);
+    TEST(test_mat9_parse);
 
     TEST(test_Mat9_access);
     TEST(test_Mat9_set);
@@ -440,6 +671,108 @@ int main(int argc, char **argv) {
     TEST(test_Mat9_operator_prod_scalar);
     TEST(test_Mat9_operator_sum);
 
+    TEST(test_Mat3_double);
+    TEST(test_Mat3_convert);
+    TEST(test_Mat3_constexpr);
+
+    TEST(test_mat9_product_simd);
+    TEST(test_mat9_invert_batch);
+
+    TEST(test_Mat9_apply);
+    TEST(test_mat9_transform);
+    TEST(test_mat9_transform_normalized);
+
+}
+
+#endif
+
+#ifdef BENCH_MAT9
+
+#include <chrono>
+#include <cstdio>
+
+// keep the compiler from dropping the computations
+template <typename T>
+static inline void keep(const T &v) {
+    asm volatile("" : : "r"(&v) : "memory");
+}
+
+template <typename F>
+static void bench(const char *name, F f, int n = 10000000, int ops = 1) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0 ; i < n ; i++)
+        f(i);
+    auto end = std::chrono::steady_clock::now();
+
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    printf("%-24s %8.2f ns/op\n", name, ns / n / ops);
+}
+
+int main(int argc, char **argv) {
+    const int nbatch = 64;
+    Mat9 m1(1.5, 2, -3, 4, 5.25, 6, 7, 8, 9.5);
+    Mat9 m2(0.5, -1, 2, 3, 4, 0.125, 6, 7, 8);
+    Mat3d d1(m1), d2(m2), dout;
+    Mat9 out, batch_in[nbatch], batch_out[nbatch];
+    const int npoints = 1024;
+    static float xs[npoints], ys[npoints], ox[npoints], oy[npoints];
+
+    for (int i = 0 ; i < npoints ; i++) {
+        xs[i] = i;
+        ys[i] = npoints - i;
+    }
+
+    for (int i = 0 ; i < nbatch ; i++)
+        batch_in[i] = m1 * Mat9::translate_matrix(i, -i);
+
+    bench("identity", [&](int i) {
+        mat9_set_identity(out);
+        keep(out);
+    });
+    bench("translate", [&](int i) {
+        mat9_set_translate(out, i, 2);
+        keep(out);
+    });
+    bench("scale", [&](int i) {
+        mat9_set_scale(out, i, 2);
+        keep(out);
+    });
+    bench("product", [&](int i) {
+        keep(m1);
+        mat9_product(m1, m2, out);
+        keep(out);
+    });
+    bench("product (simd)", [&](int i) {
+        keep(m1);
+        mat9_product_simd(m1, m2, out);
+        keep(out);
+    });
+    bench("product (double)", [&](int i) {
+        keep(d1);
+        mat9_product(d1, d2, dout);
+        keep(dout);
+    });
+    bench("invert", [&](int i) {
+        keep(m1);
+        mat9_invert(m1, out);
+        keep(out);
+    });
+    bench("invert (double)", [&](int i) {
+        keep(d1);
+        mat9_invert(d1, dout);
+        keep(dout);
+    });
+    bench("transform", [&](int i) {
+        keep(xs);
+        mat9_transform(m1, xs, ys, ox, oy, npoints);
+        keep(ox);
+        keep(oy);
+    }, 10000000 / npoints, npoints);
+    bench("invert (batch)", [&](int i) {
+        keep(batch_in);
+        mat9_invert_batch(batch_in, batch_out, nbatch);
+        keep(batch_out);
+    }, 10000000 / nbatch, nbatch);
 }
 
 #endif
@@ -23,61 +23,223 @@
 #pragma once
 
 #include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <utility>
 
-struct Mat9;
-void mat9_set_identity(Mat9 &m);
-void mat9_set_translate(Mat9 &out, float dx, float dy);
-void mat9_set_scale(Mat9 &out, float sx, float sy);
-void mat9_print(const Mat9 &m);
-void mat9_sum(const Mat9 &m1, Mat9 &m2);
-void mat9_product(const float c, Mat9 &m1);
-void mat9_product(const Mat9 &m1, const Mat9 &m2, Mat9 &m3);
-void mat9_invert(const Mat9 &m, Mat9 &minv);
-
-struct Mat9 {
-    float coeff[9];
-    float & operator[](int idx) {
+template <typename T> struct Mat3;
+
+// keep the scalar parameters out of the template argument deduction, so
+// mat9_product(4, m) works for every Mat3<T>
+template <typename T> struct mat3_scalar { typedef T type; };
+template <typename T> using mat3_scalar_t = typename mat3_scalar<T>::type;
+
+template <typename T> void mat9_print(const Mat3<T> &m);
+template <typename T> bool mat9_parse(const char *s, Mat3<T> &m);
+template <typename T> void mat9_sum(const Mat3<T> &m1, Mat3<T> &m2);
+template <typename T> void mat9_product(const mat3_scalar_t<T> c, Mat3<T> &m1);
+template <typename T> bool mat9_almost_equal(const Mat3<T> &m1, const Mat3<T> &m2, mat3_scalar_t<T> eps);
+
+// SSE/NEON versions for the float matrices (scalar when neither is available)
+void mat9_product_simd(const Mat3<float> &m1, const Mat3<float> &m2, Mat3<float> &m3);
+void mat9_invert_batch(const Mat3<float> *m, Mat3<float> *minv, int n);
+void mat9_transform(const Mat3<float> &m, const float *xs, const float *ys,
+                    float *ox, float *oy, size_t n);
+void mat9_transform_normalized(const Mat3<float> &cn, int width, int height,
+                    const float *xs, const float *ys,
+                    float *ox, float *oy, size_t n);
+
+/*
+ * 3x3 matrix, stored by rows. The functions are instantiated (in mat9.cc)
+ * for float, double and long double; Mat9 (float) is the type of the X11
+ * properties, the computations use Mat3d. The basic kernels (identity,
+ * translate, scale, product and invert) are constexpr and defined below.
+ */
+template <typename T>
+struct Mat3 {
+    T coeff[9] = {};
+    constexpr T & operator[](int idx) {
         assert(idx >= 0 && idx < 9);
         return coeff[idx];
     }
-    float operator[](int idx) const {
+    constexpr T operator[](int idx) const {
         assert(idx >= 0 && idx < 9);
         return coeff[idx];
     }
-    void set (float x0, float x1, float x2, float x3, float x4, float x5,
-        float x6, float x7, float x8) {
+    constexpr void set (T x0, T x1, T x2, T x3, T x4, T x5,
+        T x6, T x7, T x8) {
             coeff[0] = x0; coeff[1] = x1; coeff[2] = x2; coeff[3] = x3;
             coeff[4] = x4; coeff[5] = x5; coeff[6] = x6; coeff[7] = x7;
             coeff[8] = x8;
     }
-    Mat9(float x0, float x1, float x2, float x3, float x4, float x5, float x6,
-        float x7, float x8) {
+    constexpr Mat3(T x0, T x1, T x2, T x3, T x4, T x5, T x6,
+        T x7, T x8) {
             set(x0, x1, x2, x3, x4, x5, x6, x7, x8);
     }
-    Mat9() = default;
-    bool operator == (const Mat9 &other) const {
+    constexpr Mat3() = default;
+    /// conversion between precisions
+    template <typename U>
+    constexpr explicit Mat3(const Mat3<U> &other) {
+        for (int i = 0 ; i < 9 ; i++)
+            coeff[i] = (T)other.coeff[i];
+    }
+    bool operator == (const Mat3 &other) const {
         return !memcmp(coeff, other.coeff, sizeof(coeff));
     }
-    bool operator != (const Mat9 &other) const {
+    bool operator != (const Mat3 &other) const {
         return !(*this == other);
     }
 
-    void set_identity() { mat9_set_identity(*this); }
-    void set_translate(float dx, float dy) { mat9_set_translate(*this, dx, dy); }
-    void set_scale(float sx, float sy) { mat9_set_scale(*this, sx, sy); }
+    constexpr void set_identity() { mat9_set_identity(*this); }
+    constexpr void set_translate(T dx, T dy) { mat9_set_translate(*this, dx, dy); }
+    constexpr void set_scale(T sx, T sy) { mat9_set_scale(*this, sx, sy); }
     void print() const { mat9_print(*this); }
-    [[nodiscard]] Mat9 invert() const;
-
-    Mat9 operator *(const Mat9 &other) const;
-    Mat9 &operator *=(const Mat9 &other);
-    Mat9 operator +(const Mat9 &other) const;
-    Mat9 &operator +=(const Mat9 &other);
-    Mat9 operator *(float other) const;
-    Mat9 &operator *=(float other);
-
-    static Mat9 identity_matrix();
-    static Mat9 translate_matrix(float dx, float dy);
-    static Mat9 scale_matrix(float sx, float sy);
+    bool almost_equal(const Mat3 &other, T eps) const {
+        return mat9_almost_equal(*this, other, eps);
+    }
+    [[nodiscard]] constexpr Mat3 invert() const;
+
+    /// transform the point (x, y); the matrix is affine (last row 0 0 1)
+    constexpr std::pair<T, T> apply(T x, T y) const {
+        return { coeff[0] * x + coeff[1] * y + coeff[2],
+                 coeff[3] * x + coeff[4] * y + coeff[5] };
+    }
+
+    constexpr Mat3 operator *(const Mat3 &other) const;
+    Mat3 &operator *=(const Mat3 &other);
+    Mat3 operator +(const Mat3 &other) const;
+    Mat3 &operator +=(const Mat3 &other);
+    Mat3 operator *(T other) const;
+    Mat3 &operator *=(T other);
+
+    static constexpr Mat3 identity_matrix();
+    static constexpr Mat3 translate_matrix(T dx, T dy);
+    static constexpr Mat3 scale_matrix(T sx, T sy);
 };
 
-Mat9 operator *(float lth, const Mat9 &rhs);
+template <typename T>
+Mat3<T> operator *(mat3_scalar_t<T> lth, const Mat3<T> &rhs);
+
+template <typename T>
+constexpr void mat9_set_identity(Mat3<T> &m) {
+    m.set(1, 0, 0,
+          0, 1, 0,
+          0, 0, 1);
+}
+
+template <typename T>
+constexpr void mat9_set_translate(Mat3<T> &m, mat3_scalar_t<T> dx, mat3_scalar_t<T> dy) {
+    m.set(1, 0, dx,
+          0, 1, dy,
+          0, 0, 1);
+}
+
+template <typename T>
+constexpr void mat9_set_scale(Mat3<T> &m, mat3_scalar_t<T> sx, mat3_scalar_t<T> sy) {
+    m.set(sx, 0,  0,
+          0,  sy, 0,
+          0,  0,  1);
+}
+
+template <typename T>
+constexpr void mat9_product(const Mat3<T> &m1, const Mat3<T> &m2, Mat3<T> &m3) {
+    const T *a = m1.coeff, *b = m2.coeff;
+    T r[9] = {};
+
+    // m3 may be m1 or m2: compute in 'r' first
+    for (int i = 0 ; i < 3 ; i++)
+        for (int j = 0 ; j < 3 ; j++)
+            r[i*3+j] = a[i*3] * b[j] + a[i*3+1] * b[j+3] + a[i*3+2] * b[j+6];
+
+    for (int i = 0 ; i < 9 ; i++)
+        m3.coeff[i] = r[i];
+}
+
+template <typename T>
+constexpr void mat9_invert(const Mat3<T> &mat, Mat3<T> &minv) {
+    /*
+     * from https://stackoverflow.com/questions/983999/simple-3x3-matrix-inverse-code-c
+     * with some simplification
+     */
+    const T *m = mat.coeff;
+    const T m4857 = m[4] * m[8] - m[5] * m[7];
+    const T m3746 = m[3] * m[7] - m[4] * m[6];
+    const T m5638 = m[5] * m[6] - m[3] * m[8];
+    const T det = m[0] * (m4857) +
+                 m[1] * (m5638) +
+                 m[2] * (m3746);
+
+    const T invdet = 1 / det;
+
+    minv.set((m4857) * invdet,
+             (m[2] * m[7] - m[1] * m[8]) * invdet,
+             (m[1] * m[5] - m[2] * m[4]) * invdet,
+             (m5638) * invdet,
+             (m[0] * m[8] - m[2] * m[6]) * invdet,
+             (m[2] * m[3] - m[0] * m[5]) * invdet,
+             (m3746) * invdet,
+             (m[1] * m[6] - m[0] * m[7]) * invdet,
+             (m[0] * m[4] - m[1] * m[3]) * invdet);
+}
+
+template <typename T>
+constexpr Mat3<T> Mat3<T>::operator *(const Mat3 &other) const {
+    Mat3 res;
+    mat9_product(*this, other, res);
+    return res;
+}
+
+template <typename T>
+constexpr Mat3<T> Mat3<T>::invert() const {
+    Mat3 res;
+    mat9_invert(*this, res);
+    return res;
+}
+
+template <typename T>
+constexpr Mat3<T> Mat3<T>::identity_matrix() {
+    Mat3 res;
+    mat9_set_identity(res);
+    return res;
+}
+
+template <typename T>
+constexpr Mat3<T> Mat3<T>::translate_matrix(T dx, T dy) {
+    Mat3 res;
+    mat9_set_translate(res, dx, dy);
+    return res;
+}
+
+template <typename T>
+constexpr Mat3<T> Mat3<T>::scale_matrix(T sx, T sy) {
+    Mat3 res;
+    mat9_set_scale(res, sx, sy);
+    return res;
+}
+
+/*
+ * libinput works on coordinates normalized to 0..1; given the size of the
+ * screen (Sc = scale_matrix(width, height)), the matrix C in screen space
+ * and the matrix Cn passed to libinput are related by
+ *
+ *      Cn = Sc^-1 x C x Sc         C = Sc x Cn x Sc^-1
+ *
+ * (see solver_calibrate() for the details)
+ */
+template <typename T>
+constexpr Mat3<T> mat9_normalize(const Mat3<T> &c, mat3_scalar_t<T> width,
+                                 mat3_scalar_t<T> height) {
+    return Mat3<T>::scale_matrix(1 / width, 1 / height) * c *
+           Mat3<T>::scale_matrix(width, height);
+}
+
+template <typename T>
+constexpr Mat3<T> mat9_denormalize(const Mat3<T> &cn, mat3_scalar_t<T> width,
+                                   mat3_scalar_t<T> height) {
+    return Mat3<T>::scale_matrix(width, height) * cn *
+           Mat3<T>::scale_matrix(1 / width, 1 / height);
+}
+
+typedef Mat3<float> Mat9;
+typedef Mat3<double> Mat3d;
+typedef Mat3<long double> Mat3ld;
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2024 Goffredo Baroncelli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <errno.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "offline.hpp"
+#include "output.hpp"
+#include "solver.hpp"
+
+/* skip the separator after a field; false if there is something else */
+static bool next_field(const char *&p, const char *end) {
+    p = end + strspn(end, " \t");
+    if (*p == ',')
+        p++;
+    else if (*p != 0)
+        return false;
+    return true;
+}
+
+/* return the next comma separated field as a number */
+static bool next_number(const char *&p, double &v) {
+    char *end;
+    v = strtod(p, &end);
+    if (end == p)
+        return false;
+    return next_field(p, end);
+}
+
+/* return the next comma separated field as an integer in [min, max] */
+static bool next_int(const char *&p, int &v, long min, long max) {
+    char *end;
+    errno = 0;
+    long l = strtol(p, &end, 10);
+    if (end == p || errno == ERANGE || l < min || l > max)
+        return false;
+    v = l;
+    return next_field(p, end);
+}
+
+bool parse_click_record(const char *line, ClickRecord &rec) {
+    const char *p = line + strspn(line, " \t");
+    const char *comma = strchr(p, ',');
+    if (!comma)
+        return false;
+    rec.device_name.assign(p, comma);
+    p = comma + 1;
+
+    // the X coordinates are 16 bit; the grid size bounds the record size
+    if (!next_int(p, rec.width, 1, 32767) ||
+            !next_int(p, rec.height, 1, 32767) ||
+            !next_int(p, rec.grid.cols, 1, 1000) ||
+            !next_int(p, rec.grid.rows, 1, 1000) ||
+            !next_number(p, rec.grid.inset))
+        return false;
+    if (!rec.grid.valid())
+        return false;
+
+    rec.x.clear();
+    rec.y.clear();
+    while (*p) {
+        double x, y;
+        if (!next_number(p, x) || !next_number(p, y))
+            return false;
+        rec.x.push_back(x);
+        rec.y.push_back(y);
+    }
+
+    return (int)rec.x.size() == rec.grid.size();
+}
+
+int run_solve_from(const std::string &filename, const Mat9 &start,
+                   const std::string &matrix_name, int outputs,
+                   double huber_k, bool verbose) {
+    FILE *f = filename == "-" ? stdin : fopen(filename.c_str(), "r");
+    if (!f) {
+        fprintf(stderr, "ERROR: Can't open '%s'\n", filename.c_str());
+        return -1;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    char *line = nullptr;
+    size_t line_size = 0;
+    int lineno = 0, nr_ok = 0, nr_errors = 0;
+    ClickRecord rec;
+    std::vector<SolverPoint> points;
+    const Mat3d start_d(start);
+
+    // the records may be long (big grids), so don't use a fixed buffer
+    while (getline(&line, &line_size, f) >= 0) {
+        lineno++;
+        line[strcspn(line, "\r\n")] = 0;
+
+        const char *p = line + strspn(line, " \t");
+        if (*p == 0 || *p == '#')
+            continue;
+
+        Mat3d coeff;
+        points.clear();
+        bool ok = parse_click_record(p, rec);
+        if (ok) {
+            for (int i = 0 ; i < rec.grid.size() ; i++)
+                points.push_back({rec.x[i], rec.y[i],
+                                  rec.grid.x(i, rec.width),
+                                  rec.grid.y(i, rec.height)});
+            ok = solver_calibrate(points, rec.width, rec.height, huber_k,
+                                  coeff);
+        }
+        if (!ok) {
+            fprintf(stderr, "ERROR: %s:%d: wrong or degenerate record\n",
+                    filename.c_str(), lineno);
+            nr_errors++;
+            continue;
+        }
+        nr_ok++;
+
+        const Mat9 result(start_d * coeff);
+        if (outputs & SOLVE_SHOW_MATRIX)
+            printf("%s,%f,%f,%f,%f,%f,%f,%f,%f,%f\n", rec.device_name.c_str(),
+                   result[0], result[1], result[2], result[3], result[4],
+                   result[5], result[6], result[7], result[8]);
+        // only the blocks: a stream of records has to stay parsable
+        if (outputs & SOLVE_SHOW_X11)
+            printf("%s", format_xorgconfd(rec.device_name, result).c_str());
+        if (outputs & SOLVE_SHOW_XINPUT)
+            printf("%s", format_xinput(rec.device_name, matrix_name,
+                                       result).c_str());
+        if (outputs & SOLVE_SHOW_UDEV)
+            printf("%s", format_udev_libinput(rec.device_name,
+                                              result).c_str());
+        if (outputs & SOLVE_SHOW_STATS) {
+            CalibrationStats stats;
+            solver_stats(points,
+                         mat9_denormalize(coeff, rec.width, rec.height),
+                         stats);
+            output_stats(rec.device_name, stats);
+        }
+    }
+
+    free(line);
+    if (f != stdin)
+        fclose(f);
+
+    if (verbose) {
+        auto end = std::chrono::steady_clock::now();
+        double msec = std::chrono::duration<double, std::milli>(end - begin).count();
+        fprintf(stderr, "Solved %d records (%d errors) in %.1f ms\n",
+                nr_ok, nr_errors, msec);
+    }
+
+    return nr_errors;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2024 Goffredo Baroncelli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "grid.hpp"
+#include "mat9.hpp"
+
+/*
+ * Compute the calibration matrices from recorded clicks, without a X
+ * connection. Each line of the input is a record:
+ *
+ *   <device name>,<width>,<height>,<cols>,<rows>,<inset>,<x0>,<y0>,<x1>,<y1>..
+ *
+ * with a pair of coordinates for each target, in the grid order (see
+ * grid.hpp). Empty lines and lines starting with '#' are skipped.
+ */
+struct ClickRecord {
+    std::string device_name;
+    int width = 0, height = 0;
+    CalibrationGrid grid;
+    std::vector<double> x, y;
+};
+
+/// parse a record; return false if it is not valid
+bool parse_click_record(const char *line, ClickRecord &rec);
+
+enum {
+    SOLVE_SHOW_MATRIX = 1,
+    SOLVE_SHOW_XINPUT = 2,
+    SOLVE_SHOW_X11 = 4,
+    SOLVE_SHOW_UDEV = 8,
+    SOLVE_SHOW_STATS = 16,
+};
+
+/*
+ * Solve all the records of 'filename' ("-" is stdin), and show the results
+ * in the 'outputs' formats. 'start' is the matrix that was active while
+ * the clicks were recorded. Return the number of failed records.
+ */
+int run_solve_from(const std::string &filename, const Mat9 &start,
+                   const std::string &matrix_name, int outputs,
+                   double huber_k, bool verbose);
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2024 Goffredo Baroncelli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdio>
+#include <string>
+
+#include "output.hpp"
+
+std::string format_xinput(const std::string &devname,
+                          const std::string &matrix_name, const Mat9 &coeff)
+{
+    char line[2000];
+
+    snprintf(line, sizeof(line)-1,
+                "\n       xinput set-float-prop \"%s\" \"%s"
+                "\" \\\n            %f %f %f %f %f \\\n            "
+                "%f %f %f %f\n\n",
+                devname.c_str(), matrix_name.c_str(),
+                coeff[0], coeff[1], coeff[2],
+                coeff[3], coeff[4], coeff[5],
+                coeff[6], coeff[7], coeff[8]
+                           );
+    return line;
+}
+
+std::string format_xorgconfd(const std::string &devname, const Mat9 &coeff)
+{
+    char line[2000];
+    std::string outstr;
+
+    outstr += "\n";
+    outstr += "Section \"InputClass\"\n";
+    outstr += "\tIdentifier\t\"calibration\"\n";
+    snprintf(line, sizeof(line) - 1, "\tMatchProduct\t\"%s\"\n", devname.c_str());
+    outstr += line;
+    snprintf(line, sizeof(line) - 1,
+                "\tOption\t\t\"CalibrationMatrix\"\t\"%f %f %f %f %f %f %f %f %f \"\n",
+                coeff[0], coeff[1], coeff[2], coeff[3], coeff[4], coeff[5],
+                coeff[6], coeff[7], coeff[8]);
+    outstr += line;
+    outstr += "EndSection\n\n";
+
+    return outstr;
+}
+
+std::string format_udev_libinput(const std::string &device_name,
+                                 const Mat9 &coeff)
+{
+    char line[2000];
+
+    snprintf(line, sizeof(line)-1,
+            "SUBSYSTEM==\"input\", "
+                "KERNEL==\"event[0-9]*\", "
+                "ATTRS{name}==\"%s\", "
+                "ENV{LIBINPUT_CALIBRATION_MATRIX}=\"%f %f %f %f %f %f\"\n",
+            device_name.c_str(),
+            coeff[0], coeff[1], coeff[2],
+            coeff[3], coeff[4], coeff[5]
+    );
+    return line;
+}
+
+bool output_xinput(const std::string &devname, const std::string &matrix_name,
+                   const Mat9 &coeff, const std::string &output_filename)
+{
+    if(output_filename == "")
+        printf("Install the 'xinput' tool and copy the command(s) below in a script that starts with your X session\n");
+    else
+        printf("Writing calibration script to '%s'\n", output_filename.c_str());
+
+    std::string outstr = format_xinput(devname, matrix_name, coeff);
+
+    // console out
+    printf("%s", outstr.c_str());
+    // file out
+    if(output_filename != "") {
+        FILE* fid = fopen(output_filename.c_str(), "w");
+        if (fid == NULL) {
+            fprintf(stderr, "Error: Can't open '%s' for writing. Make sure you have the necessary rights\n", output_filename.c_str());
+            fprintf(stderr, "New calibration data NOT saved\n");
+            return false;
+        }
+        fprintf(fid, "%s", outstr.c_str());
+        fclose(fid);
+    }
+
+    return true;
+}
+
+bool output_xorgconfd(const std::string &devname, const Mat9 &coeff,
+                      const std::string &output_filename)
+{
+
+    if(output_filename.size() == 0)
+        printf("Copy the snippet below into '/etc/X11/xorg.conf.d/99-calibration.conf' (/usr/share/X11/xorg.conf.d/ in some distro's)\n");
+    else
+        printf("Writing xorg.conf calibration data to '%s'\n", output_filename.c_str());
+
+    // xorg.conf.d snippet
+    std::string outstr = format_xorgconfd(devname, coeff);
+
+    // console out
+    printf("%s", outstr.c_str());
+
+    // file out
+    if(output_filename.size()) {
+        FILE* fid = fopen(output_filename.c_str(), "w");
+        if (fid == NULL) {
+            fprintf(stderr, "Error: Can't open '%s' for writing. Make sure you have the necessary rights\n", output_filename.c_str());
+            fprintf(stderr, "New calibration data NOT saved\n");
+            return false;
+        }
+        fprintf(fid, "%s", outstr.c_str());
+        fclose(fid);
+    }
+
+    return true;
+}
+
+bool output_udev_libinput(const std::string &device_name, const Mat9 &coeff,
+                          const std::string &output_filename)
+{
+
+    if (device_name.size() == 0)
+        fprintf(stderr, "WARNING: device_name is missing\n");
+
+    if(output_filename == "")
+        printf("Copy the command below in a script like /etc/udev/rules.d/touchscreen.rules\n");
+    else
+        printf("Writing calibration script to '%s'\n", output_filename.c_str());
+
+    std::string outstr = format_udev_libinput(device_name, coeff);
+
+    // console out
+    printf("%s", outstr.c_str());
+    // file out
+    if(output_filename != "") {
+        FILE* fid = fopen(output_filename.c_str(), "w");
+        if (fid == NULL) {
+            fprintf(stderr, "Error: Can't open '%s' for writing. Make sure you have the necessary rights\n", output_filename.c_str());
+            fprintf(stderr, "New calibration data NOT saved\n");
+            return false;
+        }
+        fprintf(fid, "%s", outstr.c_str());
+        fclose(fid);
+    }
+
+    return true;
+}
+
+void output_stats(const std::string &devname, const CalibrationStats &stats)
+{
+    printf("Calibration accuracy of '%s' (pixels):\n", devname.c_str());
+    for (unsigned i = 0 ; i < stats.residuals.size() ; i++)
+        printf("\ttarget %u error:\t%.2f\n", i, stats.residuals[i]);
+    printf("\trms error:\t\t%.2f\n", stats.rms);
+    printf("\tmax error:\t\t%.2f (target %d)\n", stats.max, stats.worst);
+    printf("\tleave-one-out spread:\t%.2f\n", stats.spread);
+}
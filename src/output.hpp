@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2024 Goffredo Baroncelli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "mat9.hpp"
+#include "solver.hpp"
+
+/*
+ * Print the calibration 'coeff' (the libinput matrix) as a xinput
+ * command, a xorg.conf.d snippet or an udev rule; when 'output_filename'
+ * is not empty, save it there too. These don't need a X connection.
+ */
+bool output_xinput(const std::string &devname, const std::string &matrix_name,
+                   const Mat9 &coeff, const std::string &output_filename = "");
+bool output_xorgconfd(const std::string &devname, const Mat9 &coeff,
+                      const std::string &output_filename = "");
+bool output_udev_libinput(const std::string &device_name, const Mat9 &coeff,
+                          const std::string &output_filename = "");
+
+/// the outputs above without the instructions and the file, for scripts
+std::string format_xinput(const std::string &devname,
+                          const std::string &matrix_name, const Mat9 &coeff);
+std::string format_xorgconfd(const std::string &devname, const Mat9 &coeff);
+std::string format_udev_libinput(const std::string &device_name,
+                                 const Mat9 &coeff);
+
+/// print the accuracy of a calibration
+void output_stats(const std::string &devname, const CalibrationStats &stats);
@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2024 Goffredo Baroncelli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include "reactor.hpp"
+
+Reactor::Reactor()
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+        throw std::runtime_error(std::string("epoll_create1: ") + strerror(errno));
+
+    sigemptyset(&signals);
+    sigemptyset(&old_signals);
+}
+
+Reactor::~Reactor()
+{
+    if (signal_fd >= 0) {
+        close(signal_fd);
+        sigprocmask(SIG_SETMASK, &old_signals, NULL);
+    }
+    if (timer_fd >= 0)
+        close(timer_fd);
+    close(epoll_fd);
+}
+
+bool Reactor::add_fd(int fd, Callback cb)
+{
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+
+    const int op = handlers.count(fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(epoll_fd, op, fd, &ev) < 0) {
+        fprintf(stderr, "ERROR: epoll_ctl(%d): %s\n", fd, strerror(errno));
+        return false;
+    }
+    handlers[fd] = cb;
+
+    return true;
+}
+
+void Reactor::remove_fd(int fd)
+{
+    if (!handlers.erase(fd))
+        return;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+bool Reactor::set_timer(int msec, std::function<void(uint64_t)> cb)
+{
+    if (timer_fd < 0) {
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer_fd < 0) {
+            fprintf(stderr, "ERROR: timerfd_create: %s\n", strerror(errno));
+            return false;
+        }
+        if (!add_fd(timer_fd, [this](){ read_timer(); }))
+            return false;
+    }
+
+    struct itimerspec its;
+    its.it_interval.tv_sec = msec / 1000;
+    its.it_interval.tv_nsec = (msec % 1000) * 1000000L;
+    its.it_value = its.it_interval;
+    if (timerfd_settime(timer_fd, 0, &its, NULL) < 0) {
+        fprintf(stderr, "ERROR: timerfd_settime: %s\n", strerror(errno));
+        return false;
+    }
+    on_timer = cb;
+
+    return true;
+}
+
+bool Reactor::add_signal(int signum, std::function<void(int)> cb)
+{
+    sigset_t old;
+    sigaddset(&signals, signum);
+    if (sigprocmask(SIG_BLOCK, &signals, &old) < 0) {
+        fprintf(stderr, "ERROR: sigprocmask: %s\n", strerror(errno));
+        return false;
+    }
+
+    if (signal_fd < 0) {
+        old_signals = old;
+        signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (signal_fd < 0 || !add_fd(signal_fd, [this](){ read_signals(); })) {
+            fprintf(stderr, "ERROR: signalfd: %s\n", strerror(errno));
+            return false;
+        }
+    } else if (signalfd(signal_fd, &signals, 0) < 0) {
+        fprintf(stderr, "ERROR: signalfd: %s\n", strerror(errno));
+        return false;
+    }
+    on_signal[signum] = cb;
+
+    return true;
+}
+
+void Reactor::read_timer()
+{
+    uint64_t expirations;
+    if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;
+    if (on_timer)
+        on_timer(expirations);
+}
+
+void Reactor::read_signals()
+{
+    struct signalfd_siginfo si;
+    while (read(signal_fd, &si, sizeof(si)) == sizeof(si)) {
+        auto it = on_signal.find(si.ssi_signo);
+        if (it != on_signal.end())
+            it->second(si.ssi_signo);
+    }
+}
+
+bool Reactor::run()
+{
+    const int max_events = 8;
+    struct epoll_event events[max_events];
+
+    stopped = false;
+    while (!stopped) {
+        if (prepare)
+            prepare();
+        if (stopped)
+            break;
+
+        int n = epoll_wait(epoll_fd, events, max_events, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "ERROR: epoll_wait: %s\n", strerror(errno));
+            return false;
+        }
+
+        for (int i = 0 ; i < n && !stopped ; i++) {
+            // a callback may remove a fd, even its own one
+            auto it = handlers.find(events[i].data.fd);
+            if (it == handlers.end())
+                continue;
+            auto cb = it->second;
+            cb();
+        }
+    }
+
+    return true;
+}
+
+#ifdef TEST_REACTOR
+
+#include <cassert>
+
+void test_reactor_fd() {
+    Reactor r;
+    int fds[2];
+    assert(pipe(fds) == 0);
+
+    int calls = 0;
+    char buf[16];
+    assert(r.add_fd(fds[0], [&](){
+        assert(read(fds[0], buf, sizeof(buf)) == 3);
+        calls++;
+        r.stop();
+    }));
+    assert(write(fds[1], "abc", 3) == 3);
+    assert(r.run());
+    assert(calls == 1);
+
+    // the removed fds are not watched anymore
+    r.remove_fd(fds[0]);
+    r.remove_fd(fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void test_reactor_timer() {
+    Reactor r;
+    uint64_t ticks = 0;
+
+    assert(r.set_timer(5, [&](uint64_t n){
+        ticks += n;
+        if (ticks >= 3)
+            r.stop();
+    }));
+    assert(r.run());
+    assert(ticks >= 3);
+}
+
+void test_reactor_signal() {
+    Reactor r;
+    int got = 0;
+
+    assert(r.add_signal(SIGUSR1, [&](int signum){
+        got = signum;
+        r.stop();
+    }));
+    // blocked, so it is queued for the signalfd
+    kill(getpid(), SIGUSR1);
+    assert(r.run());
+    assert(got == SIGUSR1);
+}
+
+void test_reactor_prepare() {
+    Reactor r;
+    int calls = 0;
+
+    // prepare() can stop the loop before it sleeps
+    r.set_prepare([&](){
+        if (++calls == 2)
+            r.stop();
+    });
+    assert(r.set_timer(1, [](uint64_t){ }));
+    assert(r.run());
+    assert(calls == 2);
+}
+
+#define TEST(x) \
+    fprintf(stderr, "Start test " #x "... "); \
+    x(); \
+    fprintf(stderr, "OK\n");
+
+int main(int argc, char **argv) {
+    TEST(test_reactor_fd);
+    TEST(test_reactor_timer);
+    TEST(test_reactor_signal);
+    TEST(test_reactor_prepare);
+}
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2024 Goffredo Baroncelli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <signal.h>
+#include <stdint.h>
+
+#include <functional>
+#include <map>
+
+/*
+ * Event loop on epoll(7): it sleeps until a registered fd is readable, the
+ * timer (a timerfd) expires or a signal (received through a signalfd)
+ * arrives, then calls the relative callback. There is no polling: when
+ * nothing happens, the process doesn't wake up.
+ *
+ * The fds that buffer data in user space (e.g. the X connection: Xlib may
+ * have read more events than the ones processed) have to be drained by the
+ * 'prepare' callback, which is called before each wait.
+ */
+class Reactor {
+public:
+    typedef std::function<void(void)> Callback;
+
+    Reactor();
+    ~Reactor();
+
+    /// call 'cb' each time 'fd' is readable
+    bool add_fd(int fd, Callback cb);
+    void remove_fd(int fd);
+
+    /*
+     * call 'cb' every 'msec' milliseconds, with the number of periods
+     * elapsed since the previous call (more than 1 if the loop was busy);
+     * 'msec' = 0 stops the timer
+     */
+    bool set_timer(int msec, std::function<void(uint64_t)> cb);
+
+    /// handle 'signum' in the loop, instead of asynchronously
+    bool add_signal(int signum, std::function<void(int)> cb);
+
+    /// called before waiting for the events
+    void set_prepare(Callback cb) { prepare = cb; }
+
+    /// dispatch the events until stop(); returns false on error
+    bool run();
+    void stop() { stopped = true; }
+
+private:
+    int epoll_fd = -1;
+    int timer_fd = -1;
+    int signal_fd = -1;
+    sigset_t signals, old_signals;
+    bool stopped = false;
+
+    std::map<int, Callback> handlers;
+    std::function<void(uint64_t)> on_timer;
+    std::map<int, std::function<void(int)>> on_signal;
+    Callback prepare;
+
+    void read_timer();
+    void read_signals();
+};
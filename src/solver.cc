@@ -0,0 +1,540 @@
+/*
+ * Copyright (c) 2024 Goffredo Baroncelli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "solver.hpp"
+
+void AffineSolver::add(double x, double y, double u, double v, double w) {
+    n += w;
+    tx += w * x;
+    ty += w * y;
+    txx += w * x * x;
+    txy += w * x * y;
+    tyy += w * y * y;
+
+    sx += w * u;
+    sy += w * v;
+    txsx += w * x * u;
+    tysx += w * y * u;
+    txsy += w * x * v;
+    tysy += w * y * v;
+}
+
+bool AffineSolver::solve(Mat3d &coeff) const {
+    if (n <= 0)
+        return false;
+
+    /*
+     * Minimizing sum(w * (a*tx + b*ty + c - sx)^2) gives the normal
+     * equations
+     *
+     *  [txx  txy  tx]     [a]     [txsx]
+     *  [txy  tyy  ty]  x  [b]  =  [tysx]
+     *  [tx   ty   n ]     [c]     [sx  ]
+     *
+     * (and the same for d, e, f with sy). Removing the mean from the
+     * coordinates, the system becomes a 2x2 one on the covariances, which
+     * is better conditioned when the coordinates are large:
+     *
+     *  [cxx  cxy]     [a]     [cxu]
+     *  [cxy  cyy]  x  [b]  =  [cyu]        c = mu - a*mx - b*my
+     */
+    const double mx = tx / n, my = ty / n;
+    const double mu = sx / n, mv = sy / n;
+
+    const double cxx = txx - n * mx * mx;
+    const double cxy = txy - n * mx * my;
+    const double cyy = tyy - n * my * my;
+    const double cxu = txsx - n * mx * mu;
+    const double cyu = tysx - n * my * mu;
+    const double cxv = txsy - n * mx * mv;
+    const double cyv = tysy - n * my * mv;
+
+    const double det = cxx * cyy - cxy * cxy;
+    // the points are (almost) collinear
+    if (std::fabs(det) <= 1e-12 * (cxx * cyy) || det == 0)
+        return false;
+
+    const double a = (cxu * cyy - cyu * cxy) / det;
+    const double b = (cyu * cxx - cxu * cxy) / det;
+    const double d = (cxv * cyy - cyv * cxy) / det;
+    const double e = (cyv * cxx - cxv * cxy) / det;
+
+    coeff.set(a,    b,      mu - a * mx - b * my,
+              d,    e,      mv - d * mx - e * my,
+              0,    0,      1);
+
+    return true;
+}
+
+double solver_residual(const Mat3d &c, const SolverPoint &p) {
+    const double u = c[0] * p.tx + c[1] * p.ty + c[2];
+    const double v = c[3] * p.tx + c[4] * p.ty + c[5];
+    return std::hypot(u - p.sx, v - p.sy);
+}
+
+bool solver_huber_fit(const std::vector<SolverPoint> &points, double k,
+                      Mat3d &coeff, int iterations) {
+    AffineSolver s;
+    for (auto &p : points)
+        s.add(p.tx, p.ty, p.sx, p.sy);
+    if (!s.solve(coeff))
+        return false;
+
+    for (int it = 0 ; it < iterations ; it++) {
+        bool changed = false;
+        s.reset();
+        for (auto &p : points) {
+            const double r = solver_residual(coeff, p);
+            double w = 1.0;
+            if (r > k) {
+                w = k / r;
+                changed = true;
+            }
+            s.add(p.tx, p.ty, p.sx, p.sy, w);
+        }
+        // all the points inside the threshold: the plain fit is the answer
+        if (!changed)
+            break;
+        if (!s.solve(coeff))
+            return false;
+    }
+
+    return true;
+}
+
+int solver_find_outlier(const std::vector<SolverPoint> &points, double limit) {
+    /*
+     * Three points define exactly the transformation, so with four points
+     * there is only one "defect", shared by all of them
+     */
+    if (points.size() < 5)
+        return -1;
+
+    int worst = -1;
+    double worst_err = limit;
+
+    for (unsigned i = 0 ; i < points.size() ; i++) {
+        AffineSolver s;
+        for (unsigned j = 0 ; j < points.size() ; j++)
+            if (j != i)
+                s.add(points[j].tx, points[j].ty, points[j].sx, points[j].sy);
+
+        Mat3d coeff;
+        if (!s.solve(coeff))
+            continue;
+
+        const double err = solver_residual(coeff, points[i]);
+        if (err > worst_err) {
+            worst_err = err;
+            worst = i;
+        }
+    }
+
+    return worst;
+}
+
+bool solver_calibrate(const std::vector<SolverPoint> &points, int width,
+                      int height, double huber_k, Mat3d &coeff) {
+    /*
+     * Assuming that
+     *
+     *  [a  b  c]     [tx_i]     [sx_i]
+     *  [d  e  f]  x  [ty_i]  =  [sy_i]
+     *  [0  0  1]     [  1 ]     [ 1  ]
+     *
+     *      ^          ^        ^
+     *      C          Ti       Si
+     *
+     *  Where:
+     *   - a,b ...f      -> conversion matrix
+     *   - tx_i, ty_i    -> 'i'th touch x,y
+     *   - sx_i, sy_i    -> 'i'th screen x,y
+     *
+     * With more than 3 points the system is overdetermined: C is the
+     * least-squares solution over all the points (see AffineSolver).
+     * In robust mode the points far from the solution weigh less.
+     */
+
+    bool ok;
+    if (huber_k > 0) {
+        ok = solver_huber_fit(points, huber_k, coeff);
+    } else {
+        AffineSolver solver;
+        for (auto &p : points)
+            solver.add(p.tx, p.ty, p.sx, p.sy);
+        ok = solver.solve(coeff);
+    }
+
+    if (!ok)
+        return false;
+
+    /*
+     *             Coefficient normalization
+     *
+     * The matrix to pass to libinput has to be normalized; we need to
+     * translate and scale the coeffiecient so the matrix can operate in
+     * a space where the coordinates x and y (both in input and output) are
+     * in the range 0..1
+     *
+     * To do that, assume:
+     *
+     * a "translation" matrix is
+     *       [ 1 0 dx ]
+     * Tr =  [ 0 1 dy ]
+     *       [ 0 0 1  ]
+     *
+     * a "scale" matrix is
+     *       [ sx 0  0 ]
+     * Sc =  [ 0  sy 0 ]
+     *       [ 0  0  1 ]
+     *
+     * To change the coordinate from the normalizate space to the screen space
+     * - First we need to scale from (0..1 x 0..1) to (width x height); so
+     *   sx = maxx - minx + 1 = width, sy = maxy - miny + 1 = height
+     * - Second we need to translate
+     *   from (0..width-1 x 0..hight-1) to (minx..maxx x miny..maxy)
+     *   so dx = minx, dy = miny
+     *
+     * So
+     *    C = Tr x Sc x Cn x Sc^-1 x Tc^-1
+     * this means that
+     *    Cn = Sc^-1 x Tr^-1 x C x Tr x Sc
+     * where
+     *      C is the Calibration matrix in the "screen" spaces
+     *      Cn is the normalizated matrix that can be passed to libinput
+     *
+     * Because in the screen space usually minx=miny=0, this means
+     * that dx == dy == 0 -> T == T^-1 == identity. So we can write
+     *      Cn = Sc^-1 x C x Sc
+     *
+     *
+     * and because
+     *
+     *                ⎡a  b  c⎤
+     *                ⎢       ⎥
+     *        C   =   ⎢d  e  f⎥
+     *                ⎢       ⎥
+     *                ⎣0  0  1⎦
+     *
+     * then
+     *              ⎡      b⋅sy  c ⎤
+     *              ⎢ a    ────  ──⎥
+     *              ⎢       sx   sx⎥
+     *              ⎢              ⎥
+     *       Cn =   ⎢d⋅sx        f ⎥
+     *              ⎢────   e    ──⎥
+     *              ⎢ sy         sy⎥
+     *              ⎢              ⎥
+     *              ⎣ 0     0    1 ⎦
+     *
+     *
+     *
+     * See libinput function evdev_device_calibrate() (in src/evdev.c)
+     *
+     * As further reference, if dx/dy are not zero:
+     *
+     *              ⎡        b⋅sy            b⋅dy⋅sy   c      ⎤
+     *              ⎢ a      ────     a⋅dx + ─────── + ── - dx⎥
+     *              ⎢         sx                sx     sx     ⎥
+     *              ⎢                                         ⎥
+     *              ⎢d⋅sx             d⋅dx⋅sx               f ⎥
+     *       Cn =   ⎢────     e       ─────── + dy⋅e - dy + ──⎥
+     *              ⎢ sy                 sy                 sy⎥
+     *              ⎢                                         ⎥
+     *              ⎣ 0       0                  1            ⎦
+     */
+
+    coeff = mat9_normalize(coeff, width, height);
+
+    /*
+     * Sometimes, the last row values are like -0.0, -0.0, 1
+     * update to the right values, otherwise libinput complaints !
+     */
+    coeff[6] = 0.0;
+    coeff[7] = 0.0;
+    coeff[8] = 1.0;
+
+    return true;
+}
+
+void solver_stats(const std::vector<SolverPoint> &points, const Mat3d &coeff,
+                  CalibrationStats &stats) {
+    stats = CalibrationStats();
+
+    double sum2 = 0;
+    for (unsigned i = 0 ; i < points.size() ; i++) {
+        const double r = solver_residual(coeff, points[i]);
+        stats.residuals.push_back(r);
+        sum2 += r * r;
+        if (r > stats.max) {
+            stats.max = r;
+            stats.worst = i;
+        }
+    }
+    if (points.size())
+        stats.rms = std::sqrt(sum2 / points.size());
+
+    for (unsigned i = 0 ; i < points.size() ; i++) {
+        AffineSolver s;
+        for (unsigned j = 0 ; j < points.size() ; j++)
+            if (j != i)
+                s.add(points[j].tx, points[j].ty, points[j].sx, points[j].sy);
+
+        Mat3d sub;
+        if (!s.solve(sub))
+            continue;
+
+        // compare where the two solutions put the clicks
+        for (auto &p : points) {
+            auto [x1, y1] = coeff.apply(p.tx, p.ty);
+            auto [x2, y2] = sub.apply(p.tx, p.ty);
+            stats.spread = std::max(stats.spread, std::hypot(x1 - x2, y1 - y2));
+        }
+    }
+}
+
+#ifdef TEST_SOLVER
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+static void check_coeff(const Mat3d &m, const Mat3d &expected, float eps) {
+    for (int i = 0 ; i < 9 ; i++)
+        assert(std::fabs(m[i] - expected[i]) <= eps * (1 + std::fabs(expected[i])));
+}
+
+void test_solver_exact() {
+    const Mat3d c(1.1, 0.02, -30, -0.01, 0.95, 12, 0, 0, 1);
+    const double pts[][2] = { {240, 135}, {1679, 135}, {240, 944}, {1679, 944} };
+    AffineSolver s;
+
+    for (auto &p : pts)
+        s.add(p[0], p[1], c[0] * p[0] + c[1] * p[1] + c[2],
+                          c[3] * p[0] + c[4] * p[1] + c[5]);
+
+    Mat3d res;
+    assert(s.solve(res));
+    check_coeff(res, c, 1e-5);
+    assert(s.count() == 4);
+}
+
+void test_solver_many_points() {
+    // 4K panel, 5x5 grid
+    const Mat3d c(0.98, -0.004, 15, 0.003, 1.02, -8, 0, 0, 1);
+    AffineSolver s;
+
+    for (int i = 0 ; i < 5 ; i++) {
+        for (int j = 0 ; j < 5 ; j++) {
+            double x = 384 + i * 768, y = 216 + j * 432;
+            s.add(x, y, c[0] * x + c[1] * y + c[2], c[3] * x + c[4] * y + c[5]);
+        }
+    }
+
+    Mat3d res;
+    assert(s.solve(res));
+    check_coeff(res, c, 1e-5);
+}
+
+void test_solver_noise() {
+    // symmetric noise on the 4 corners cancels out
+    const double pts[][2] = { {100, 100}, {900, 100}, {100, 700}, {900, 700} };
+    const double noise[][2] = { {2, -1}, {-2, 1}, {-2, 1}, {2, -1} };
+    AffineSolver s;
+
+    for (int i = 0 ; i < 4 ; i++)
+        s.add(pts[i][0] + noise[i][0], pts[i][1] + noise[i][1],
+              pts[i][0], pts[i][1]);
+
+    Mat3d res;
+    assert(s.solve(res));
+    for (int i = 0 ; i < 4 ; i++) {
+        double x = pts[i][0] + noise[i][0], y = pts[i][1] + noise[i][1];
+        double u = res[0] * x + res[1] * y + res[2];
+        double v = res[3] * x + res[4] * y + res[5];
+        assert(std::fabs(u - pts[i][0]) < 3 && std::fabs(v - pts[i][1]) < 3);
+    }
+}
+
+void test_solver_degenerate() {
+    AffineSolver s;
+    Mat3d res;
+
+    assert(!s.solve(res));
+
+    s.add(0, 0, 0, 0);
+    s.add(10, 10, 10, 10);
+    s.add(20, 20, 20, 20);
+    assert(!s.solve(res));
+
+    s.reset();
+    assert(s.count() == 0);
+}
+
+void test_solver_weights() {
+    AffineSolver s1, s2;
+    Mat3d r1, r2;
+    const double pts[][4] = {
+        {100, 100, 90, 95}, {900, 100, 905, 102},
+        {100, 700, 97, 690}, {900, 700, 910, 705}
+    };
+
+    for (auto &p : pts) {
+        s1.add(p[0], p[1], p[2], p[3], 2.0);
+        s2.add(p[0], p[1], p[2], p[3]);
+        s2.add(p[0], p[1], p[2], p[3]);
+    }
+    assert(s1.solve(r1) && s2.solve(r2));
+    check_coeff(r1, r2, 1e-6);
+}
+
+static std::vector<SolverPoint> make_grid(const Mat3d &c, int cols, int rows) {
+    std::vector<SolverPoint> v;
+    for (int r = 0 ; r < rows ; r++) {
+        for (int i = 0 ; i < cols ; i++) {
+            double x = 100 + i * 800.0 / (cols - 1);
+            double y = 100 + r * 600.0 / (rows - 1);
+            // touch coordinates = c^-1 x screen
+            Mat3d ci;
+            mat9_invert(c, ci);
+            v.push_back({ci[0] * x + ci[1] * y + ci[2],
+                         ci[3] * x + ci[4] * y + ci[5], x, y});
+        }
+    }
+    return v;
+}
+
+void test_solver_huber() {
+    const Mat3d c(1.05, 0.01, -20, 0.02, 0.97, 10, 0, 0, 1);
+    auto pts = make_grid(c, 3, 3);
+    pts[4].tx += 80;
+    pts[4].ty -= 60;
+
+    Mat3d plain, robust;
+    AffineSolver s;
+    for (auto &p : pts)
+        s.add(p.tx, p.ty, p.sx, p.sy);
+    assert(s.solve(plain));
+    assert(solver_huber_fit(pts, 5, robust, 50));
+
+    // the good points are fitted better by the robust solution
+    double e_plain = 0, e_robust = 0;
+    for (int i = 0 ; i < 9 ; i++) {
+        if (i == 4)
+            continue;
+        e_plain = std::max(e_plain, solver_residual(plain, pts[i]));
+        e_robust = std::max(e_robust, solver_residual(robust, pts[i]));
+    }
+    assert(e_robust < e_plain / 2);
+}
+
+void test_solver_find_outlier() {
+    const Mat3d c(1.05, 0.01, -20, 0.02, 0.97, 10, 0, 0, 1);
+    auto pts = make_grid(c, 3, 3);
+
+    assert(solver_find_outlier(pts, 10) == -1);
+
+    pts[2].tx += 50;
+    assert(solver_find_outlier(pts, 10) == 2);
+
+    // four corners: the culprit can't be told apart
+    auto corners = make_grid(c, 2, 2);
+    assert(solver_find_outlier(corners, 10) == -1);
+    corners[1].ty += 50;
+    assert(solver_find_outlier(corners, 10) == -1);
+}
+
+void test_solver_kahan() {
+    KahanSum k;
+    double plain = 0;
+
+    k += 1e16;
+    plain += 1e16;
+    for (int i = 0 ; i < 1000 ; i++) {
+        k += 1.0;
+        plain += 1.0;
+    }
+    k += -1e16;
+    plain += -1e16;
+
+    assert((double)k == 1000);
+    assert(plain != 1000);
+}
+
+void test_solver_stats() {
+    const Mat3d c(1.05, 0.01, -20, 0.02, 0.97, 10, 0, 0, 1);
+    auto pts = make_grid(c, 3, 3);
+    CalibrationStats stats;
+
+    solver_stats(pts, c, stats);
+    assert(stats.residuals.size() == 9);
+    assert(stats.rms < 1e-6 && stats.max < 1e-6 && stats.spread < 1e-6);
+
+    pts[5].sx += 6;
+    pts[5].sy += 8;
+    solver_stats(pts, c, stats);
+    assert(std::fabs(stats.residuals[5] - 10) < 1e-6);
+    assert(std::fabs(stats.max - 10) < 1e-6 && stats.worst == 5);
+    assert(std::fabs(stats.rms - 10 / 3.0) < 1e-6);
+    assert(stats.spread > 1);
+}
+
+void test_solver_sampler() {
+    PointSampler s;
+    const double xs[] = {100, 102, 98, 101, 99};
+
+    assert(std::isinf(s.confidence()));
+    for (double x : xs)
+        s.add(x, 2 * x);
+
+    assert(s.count() == 5);
+    assert(std::fabs(s.mean_x() - 100) < 1e-12);
+    assert(std::fabs(s.mean_y() - 200) < 1e-12);
+    // variance of y = 4 * 2.5
+    assert(std::fabs(s.confidence() - 1.96 * std::sqrt(10.0 / 5)) < 1e-9);
+
+    s.reset();
+    assert(s.count() == 0);
+}
+
+#define TEST(x) \
+    fprintf(stderr, "Start test " #x "... "); \
+    x(); \
+    fprintf(stderr, "OK\n");
+
+int main(int argc, char **argv) {
+    TEST(test_solver_kahan);
+    TEST(test_solver_exact);
+    TEST(test_solver_many_points);
+    TEST(test_solver_noise);
+    TEST(test_solver_degenerate);
+    TEST(test_solver_weights);
+    TEST(test_solver_huber);
+    TEST(test_solver_find_outlier);
+    TEST(test_solver_stats);
+    TEST(test_solver_sampler);
+}
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2024 Goffredo Baroncelli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "mat9.hpp"
+
+/*
+ * Compensated (Kahan-Babuska-Neumaier) summation: the rounding error of
+ * each addition is kept apart and added back at the end. The sums of the
+ * squared pixel coordinates are large compared to the single terms.
+ */
+class KahanSum {
+public:
+    KahanSum &operator +=(double v) {
+        const double t = sum + v;
+        if (std::fabs(sum) >= std::fabs(v))
+            comp += (sum - t) + v;
+        else
+            comp += (v - t) + sum;
+        sum = t;
+        return *this;
+    }
+    operator double() const { return sum + comp; }
+
+private:
+    double sum = 0, comp = 0;
+};
+
+/*
+ * Least-squares fit of the affine transformation that maps the touch
+ * coordinates (tx, ty) to the screen coordinates (sx, sy):
+ *
+ *      [a  b  c]     [tx]     [sx]
+ *      [d  e  f]  x  [ty]  =  [sy]
+ *      [0  0  1]     [ 1]     [ 1]
+ *
+ * The correspondences are accumulated in the sums used by the normal
+ * equations, so the memory doesn't depend on the number of points. All
+ * the computations are in double; the caller converts the result to Mat9
+ * only to store it in the X property.
+ */
+class AffineSolver {
+public:
+    void reset() { *this = AffineSolver(); }
+
+    /// add a correspondence, with weight 'w'
+    void add(double tx, double ty, double sx, double sy, double w = 1.0);
+
+    /// number of points (sum of the weights)
+    double count() const { return n; }
+
+    /// return false when the points don't define a transformation
+    bool solve(Mat3d &coeff) const;
+
+private:
+    // touch coordinates
+    KahanSum n, tx, ty, txx, txy, tyy;
+    // screen coordinates
+    KahanSum sx, sy, txsx, tysx, txsy, tysy;
+};
+
+/*
+ * Streaming mean and variance (Welford) of the samples taken on a
+ * target, to decide when the mean is known well enough
+ */
+class PointSampler {
+public:
+    void reset() { *this = PointSampler(); }
+
+    void add(double x, double y) {
+        n++;
+        const double dx = x - mx, dy = y - my;
+        mx += dx / n;
+        my += dy / n;
+        m2x += dx * (x - mx);
+        m2y += dy * (y - my);
+    }
+
+    int count() const { return n; }
+    double mean_x() const { return mx; }
+    double mean_y() const { return my; }
+
+    /*
+     * half width (pixels) of the 95% confidence interval of the mean, on
+     * the worst axis; infinite with less than 'min_samples' samples
+     */
+    double confidence() const {
+        if (n < min_samples)
+            return INFINITY;
+        const double var = std::max(m2x, m2y) / (n - 1);
+        return 1.96 * std::sqrt(var / n);
+    }
+
+    static constexpr int min_samples = 3;
+
+private:
+    int n = 0;
+    double mx = 0, my = 0, m2x = 0, m2y = 0;
+};
+
+/// a touch/target correspondence
+struct SolverPoint {
+    double tx, ty;      // touch
+    double sx, sy;      // screen
+};
+
+/// distance between the target and the transformed touch
+double solver_residual(const Mat3d &coeff, const SolverPoint &p);
+
+/*
+ * Huber-weighted fit (iteratively reweighted least squares): the points
+ * with a residual greater than 'k' pixels get weight k/residual, so a
+ * single bad tap can't drag the whole solution.
+ */
+bool solver_huber_fit(const std::vector<SolverPoint> &points, double k,
+                      Mat3d &coeff, int iterations = 10);
+
+/*
+ * Find the point least consistent with the others: each point is
+ * compared with the solution computed without it. Return its index if the
+ * error is greater than 'limit' pixels, otherwise -1.
+ *
+ * With less than five points the culprit can't be told apart (with four,
+ * on a rectangle, the errors are all the same): -1 is returned.
+ */
+int solver_find_outlier(const std::vector<SolverPoint> &points, double limit);
+
+/*
+ * Compute the libinput calibration matrix (normalized to 0..1, see
+ * mat9_normalize()) of a width x height screen from the clicks: the
+ * plain least-squares fit, or the Huber one if 'huber_k' > 0. It doesn't
+ * include the matrix active while the points were clicked.
+ */
+bool solver_calibrate(const std::vector<SolverPoint> &points, int width,
+                      int height, double huber_k, Mat3d &coeff);
+
+/*
+ * Accuracy of a calibration, in screen pixels. The residual of a target
+ * is the distance between the target and the corrected click; the spread
+ * is the largest distance, over all the targets, between the solution and
+ * the sub-solutions computed leaving out one click at time: a high value
+ * means that the result depends too much on a single click.
+ */
+struct CalibrationStats {
+    std::vector<double> residuals;
+    double rms = 0;
+    double max = 0;
+    int worst = -1;
+    double spread = 0;
+};
+
+/// compute the stats of 'coeff' (in screen space, not normalized)
+void solver_stats(const std::vector<SolverPoint> &points, const Mat3d &coeff,
+                  CalibrationStats &stats);
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2024 Goffredo Baroncelli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <X11/extensions/XInput.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "xatoms.hpp"
+#include "xinput.hpp"
+
+static const char *const device_types[] = {
+    XI_MOUSE, XI_TABLET, XI_KEYBOARD, XI_TOUCHSCREEN, XI_TOUCHPAD,
+    XI_BUTTONBOX, XI_BARCODE, XI_TRACKBALL, XI_QUADRATURE, XI_ID_MODULE,
+    XI_ONE_KNOB, XI_NINE_KNOB, XI_KNOB_BOX, XI_SPACEBALL, XI_DATAGLOVE,
+    XI_EYETRACKER, XI_CURSORKEYS, XI_FOOTMOUSE, XI_JOYSTICK
+};
+static const int nr_device_types = sizeof(device_types) / sizeof(device_types[0]);
+
+/* atoms interned together with the device types */
+static const char *const other_atoms[] = {
+    "FLOAT", LICALMATR, XICALMATR
+};
+static const int nr_other_atoms = sizeof(other_atoms) / sizeof(other_atoms[0]);
+
+static std::mutex registry_lock;
+static std::map<Display *, std::unique_ptr<XAtoms>> registry;
+
+XAtoms &XAtoms::get(Display *display) {
+    std::lock_guard<std::mutex> lock(registry_lock);
+
+    auto &r = registry[display];
+    if (!r)
+        r.reset(new XAtoms(display));
+    return *r;
+}
+
+void XAtoms::release(Display *display) {
+    std::lock_guard<std::mutex> lock(registry_lock);
+    registry.erase(display);
+}
+
+XAtoms::XAtoms(Display *display_) : display(display_) {
+    const char *all_names[nr_device_types + nr_other_atoms];
+    Atom all_atoms[nr_device_types + nr_other_atoms];
+    int i;
+
+    for (i = 0 ; i < nr_device_types ; i++)
+        all_names[i] = device_types[i];
+    for (i = 0 ; i < nr_other_atoms ; i++)
+        all_names[nr_device_types + i] = other_atoms[i];
+
+    XInternAtoms(display, (char **)all_names, nr_device_types + nr_other_atoms,
+                 False, all_atoms);
+
+    for (i = 0 ; i < nr_device_types + nr_other_atoms ; i++)
+        remember(all_atoms[i], all_names[i]);
+    for (i = 0 ; i < nr_device_types ; i++)
+        type_names[all_atoms[i]] = device_types[i];
+
+    float_atom = atoms["FLOAT"];
+    xi_touchscreen = atoms[XI_TOUCHSCREEN];
+}
+
+std::string XAtoms::type_to_string(Atom type) const {
+    auto it = type_names.find(type);
+    if (it != type_names.end())
+        return it->second;
+
+    return "<UNKNOWN:" + std::to_string((unsigned long long)type) + ">";
+}
+
+Atom XAtoms::intern(const std::string &name) {
+    auto it = atoms.find(name);
+    if (it != atoms.end())
+        return it->second;
+
+    Atom atom = XInternAtom(display, name.c_str(), False);
+    remember(atom, name);
+    return atom;
+}
+
+std::string XAtoms::name(Atom atom) {
+    auto it = names.find(atom);
+    if (it != names.end())
+        return it->second;
+
+    auto n = XGetAtomName(display, atom);
+    if (!n)
+        return std::to_string(atom);
+
+    std::string ret(n);
+    XFree(n);
+    remember(atom, ret);
+    return ret;
+}
+
+void XAtoms::remember(Atom atom, const std::string &name) {
+    if (atom == None)
+        return;
+    atoms[name] = atom;
+    names[atom] = name;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2024 Goffredo Baroncelli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <X11/Xlib.h>
+
+#include <string>
+#include <unordered_map>
+
+/*
+ * Per-Display registry of the atoms used by xlibinput_calibrator. All the
+ * well known atoms are interned with a single XInternAtoms() request the
+ * first time a Display is seen; the other names are cached when they are
+ * first interned or resolved.
+ */
+class XAtoms {
+public:
+    static XAtoms &get(Display *display);
+    /* drop the registry of a Display, before XCloseDisplay() */
+    static void release(Display *display);
+
+    Atom float_atom;
+    Atom xi_touchscreen;
+
+    /* name of an XInput device type, or "<UNKNOWN:nn>" */
+    std::string type_to_string(Atom type) const;
+
+    Atom intern(const std::string &name);
+    std::string name(Atom atom);
+    void remember(Atom atom, const std::string &name);
+
+private:
+    XAtoms(Display *display);
+
+    Display *display;
+    std::unordered_map<Atom, const char *> type_names;
+    std::unordered_map<std::string, Atom> atoms;
+    std::unordered_map<Atom, std::string> names;
+};
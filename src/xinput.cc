@@ -29,76 +29,35 @@
 #include <cctype>
 #include <cstdlib>
 
+#include <algorithm>
+
 #include "xinput.hpp"
+#ifdef HAVE_XCB_XINPUT
+#include "xinput_xcb.hpp"
+#endif
 
-std::string XInputTouch::type_to_string(Atom type) {
-
-        if (type == xi_mouse)
-            return "MOUSE";
-        if (type == xi_tablet)
-            return "TABLET";
-        if (type == xi_keyboard)
-            return "KEYBOARD";
-        if (type == xi_touchscreen)
-            return "TOUCHSCREEN";
-        if (type == xi_touchpad)
-            return "TOUCHPAD";
-        if (type == xi_buttonbox)
-            return "BUTTONBOX";
-        if (type == xi_barcode)
-            return "BARCODE";
-        if (type == xi_trackball)
-            return "TRACKBALL";
-        if (type == xi_quadrature)
-            return "QUADRATURE";
-        if (type == xi_id_module)
-            return "ID_MODULE";
-        if (type == xi_one_knob)
-            return "ONE_KNOB";
-        if (type == xi_nine_knob)
-            return "NINE_KNOB";
-        if (type == xi_knob_box)
-            return "KNOB_BOX";
-        if (type == xi_spaceball)
-            return "SPACEBALL";
-        if (type == xi_dataglove)
-            return "DATAGLOVE";
-        if (type == xi_eyetracker)
-            return "EYETRACKER";
-        if (type == xi_cursorkeys)
-            return "CURSORKEYS";
-        if (type == xi_footmouse)
-            return "FOOTMOUSE";
-        if (type == xi_joystick)
-            return "JOYSTICK";
-
-	static char buf[100];
-	sprintf(buf, "<UNKNOWN:%llu>", (unsigned long long)type);
-	return buf;
+XDevicePool::XDeviceHandle XDevicePool::get(XID id) {
+    auto it = devices.find(id);
+    if (it != devices.end())
+        return it->second;
+
+    auto dev = XOpenDevice(display, id);
+    if (!dev)
+        return nullptr;
+
+    auto d = display;
+    XDeviceHandle h(dev, [d](XDevice *dev) { XCloseDevice(d, dev); });
+    devices[id] = h;
+    return h;
 }
 
-XInputTouch::XInputTouch(Display *display_) {
-    display = display_;
-    xi_touchscreen = XInternAtom(display, XI_TOUCHSCREEN, false);
-    xi_mouse = XInternAtom(display, XI_MOUSE, false);
-    xi_keyboard = XInternAtom(display, XI_KEYBOARD, false);
-    float_atom = XInternAtom(display, "FLOAT", false);
-    xi_tablet = XInternAtom(display, XI_TABLET, false);
-    xi_touchpad = XInternAtom(display, XI_TOUCHPAD, false);
-    xi_buttonbox = XInternAtom(display, XI_BUTTONBOX, false);
-    xi_barcode = XInternAtom(display, XI_BARCODE, false);
-    xi_trackball = XInternAtom(display, XI_TRACKBALL, false);
-    xi_quadrature = XInternAtom(display, XI_QUADRATURE, false);
-    xi_id_module = XInternAtom(display, XI_ID_MODULE, false);
-    xi_one_knob = XInternAtom(display, XI_ONE_KNOB, false);
-    xi_nine_knob = XInternAtom(display, XI_NINE_KNOB, false);
-    xi_knob_box = XInternAtom(display, XI_KNOB_BOX, false);
-    xi_spaceball = XInternAtom(display, XI_SPACEBALL, false);
-    xi_dataglove = XInternAtom(display, XI_DATAGLOVE, false);
-    xi_eyetracker = XInternAtom(display, XI_EYETRACKER, false);
-    xi_cursorkeys = XInternAtom(display, XI_CURSORKEYS, false);
-    xi_footmouse = XInternAtom(display, XI_FOOTMOUSE, false);
-    xi_joystick = XInternAtom(display, XI_JOYSTICK, false);
+XInputTouch::XInputTouch(Display *display_)
+    : display(display_), atoms(XAtoms::get(display_)), device_pool(display_) {
+#ifdef HAVE_XCB_XINPUT
+    xcb.reset(new XInputXcb(display));
+    if (!xcb->valid())
+        xcb.reset();
+#endif
 }
 
 XInputTouch::~XInputTouch() {
@@ -106,10 +65,11 @@ XInputTouch::~XInputTouch() {
 
 int XInputTouch::find_touch(std::vector<XInputTouch::XDevInfo> &ret) {
     int count = 0;
+    auto snap = snapshot();
 
-    for (auto  &dev: list_devices()) {
+    for (auto  &dev: snap->devices()) {
 
-        if (dev.type != xi_touchscreen)
+        if (dev.type != atoms.xi_touchscreen)
                 continue;
 
         ret.push_back(dev);
@@ -125,14 +85,9 @@ int XInputTouch::find_touch(std::vector<XInputTouch::XDevInfo> &ret) {
      * xi_touchscreen was found
      */
 
-    for (auto  &dev: list_devices()) {
+    for (auto  &dev: snap->devices()) {
 
-        /* Can't query properties of devices that have no type at all,
-         * so check that first. */
-        if (!dev.type)
-            continue;
-
-        if (has_prop(dev.id, LICALMATR) != 0)
+        if (!snap->has_prop(dev.id, LICALMATR))
                 continue;
 
         ret.push_back(dev);
@@ -142,29 +97,158 @@ int XInputTouch::find_touch(std::vector<XInputTouch::XDevInfo> &ret) {
     return count;
 }
 
+int XInputTouch::resolve_device(XID &id, std::string &name,
+                                std::vector<XInputTouch::XDevInfo> &candidates)
+{
+    if (id == (XID)-1 && name == "") {
+        if (find_touch(candidates) != 1)
+            return -1;
+
+        name = candidates[0].name;
+        id = candidates[0].id;
+        return 0;
+    }
+
+    const auto snap = snapshot();
+    const XDevInfo *dev;
+    if (id != (XID)-1)
+        dev = snap->find(id);
+    else
+        dev = snap->find(name);
+    if (!dev)
+        return -2;
+
+    id = dev->id;
+    name = dev->name;
+    return 0;
+}
+
+int XInputTouch::resolve_matrix(XID id, std::string &matrix_name)
+{
+    const auto snap = snapshot();
+
+    if (matrix_name != "")
+        return snap->has_prop(id, matrix_name) ? 0 : -1;
+
+    if (snap->has_prop(id, LICALMATR))
+        matrix_name = LICALMATR;
+    else if (snap->has_prop(id, XICALMATR))
+        matrix_name = XICALMATR;
+    else
+        return -1;
+
+    return 0;
+}
+
 std::vector<XInputTouch::XDevInfo> XInputTouch::list_devices()
+{
+    return snapshot()->devices();
+}
 
+std::shared_ptr<const XInputTouch::Snapshot> XInputTouch::snapshot()
 {
+    if (cached_snapshot)
+        return cached_snapshot;
+
     XDeviceInfo	*devices;
     int		loop;
     int		num_devices;
 
-    std::vector<XInputTouch::XDevInfo> ret;
+    auto snap = std::make_shared<Snapshot>();
 
     devices = XListInputDevices(display, &num_devices);
 
     for (loop=0; loop<num_devices; loop++) {
+        /* Can't query properties of devices that have no type at all */
         if (!devices[loop].type)
             continue;
-        ret.push_back({devices[loop].name,
+
+        snap->devs.push_back({devices[loop].name,
 		devices[loop].id,
 		devices[loop].type,
-		type_to_string(devices[loop].type)});
+		atoms.type_to_string(devices[loop].type), {}, {}});
     }
 
     XFreeDeviceList(devices);
 
-    return ret;
+#ifdef HAVE_XCB_XINPUT
+    if (xcb) {
+        std::vector<XID> ids;
+        std::vector<std::vector<Atom>> props;
+        for (auto &dev : snap->devs)
+            ids.push_back(dev.id);
+        xcb->list_props(ids, props);
+        for (auto i = 0u ; i < ids.size() ; i++)
+            snap->devs[i].prop_atoms = std::move(props[i]);
+    } else
+#endif
+    for (auto &info : snap->devs) {
+        auto dev = device_pool.get(info.id);
+        if (dev) {
+            int nprops;
+            auto props = XListDeviceProperties(display, dev.get(), &nprops);
+            if (props) {
+                info.prop_atoms.assign(props, props + nprops);
+                XFree(props);
+            }
+        }
+    }
+
+    /* resolve the names of all the properties in a single request */
+    std::vector<Atom> all_props;
+    for (auto &dev : snap->devs)
+        all_props.insert(all_props.end(), dev.prop_atoms.begin(),
+                         dev.prop_atoms.end());
+
+    if (all_props.size()) {
+        std::vector<char *> names(all_props.size());
+        if (XGetAtomNames(display, all_props.data(), all_props.size(),
+                          names.data())) {
+            auto it = names.begin();
+            for (auto &dev : snap->devs) {
+                for (auto i = 0u ; i < dev.prop_atoms.size() ; i++, it++) {
+                    dev.props.push_back(*it);
+                    atoms.remember(dev.prop_atoms[i], *it);
+                    XFree(*it);
+                }
+            }
+        } else {
+            for (auto &dev : snap->devs)
+                dev.prop_atoms.clear();
+        }
+    }
+
+    cached_snapshot = snap;
+    return cached_snapshot;
+}
+
+const XInputTouch::XDevInfo *XInputTouch::Snapshot::find(XID id) const
+{
+    for (auto &dev : devs)
+        if (dev.id == id)
+            return &dev;
+    return nullptr;
+}
+
+const XInputTouch::XDevInfo *
+XInputTouch::Snapshot::find(const std::string &name) const
+{
+    for (auto &dev : devs)
+        if (dev.name == name)
+            return &dev;
+    return nullptr;
+}
+
+bool XInputTouch::Snapshot::has_prop(XID id,
+                                     const std::string &prop_name) const
+{
+    auto dev = find(id);
+    if (!dev)
+        return false;
+    for (auto &p : dev->props)
+        if (p == prop_name)
+            return true;
+    return false;
 }
 
 Atom XInputTouch::parse_atom(const char *name) {
@@ -181,208 +265,279 @@ Atom XInputTouch::parse_atom(const char *name) {
     if (is_atom)
         return atoi(name);
     else
-        return XInternAtom(display, name, False);
+        return atoms.intern(name);
 }
 
-int XInputTouch::get_prop(int devid, const char *pname,
-                    std::vector<std::string> &ret)
+int XInputTouch::get_prop(int devid, const char *pname, XPropData &ret)
 {
-    auto dev = XOpenDevice(display, devid);
+    Atom property = parse_atom(pname);
+
+    if (property == None) {
+        fprintf(stderr, "invalid property '%s'\n", pname);
+        return -1;
+    }
+
+#ifdef HAVE_XCB_XINPUT
+    if (xcb) {
+        std::vector<XPropData> data;
+        if (xcb->get_props({{devid, property}}, data) < 0)
+            return -2;
+
+        ret = data[0];
+        return ret.nitems ? 0 : -4;
+    }
+#endif
+
+    auto dev = device_pool.get(devid);
     if (!dev)
     {
         fprintf(stderr, "unable to open device '%d'\n", devid);
         return -2;
     }
-    auto r = get_prop(dev, pname, ret);
-    XCloseDevice(display, dev);
 
-    return r;
+    return get_prop(dev.get(), property, ret);
 }
-int XInputTouch::get_prop(XDevice* dev, const char *pname,
+
+int XInputTouch::get_prop(int devid, const char *pname,
                     std::vector<std::string> &ret)
 {
-    Atom                act_type, property;
-    char                *name;
-    int                 act_format;
-    unsigned long       nitems, bytes_after;
-    unsigned char       *data, *ptr;
-    int                 j, done = False, size = 0;
+    XPropData prop;
 
+    auto r = get_prop(devid, pname, prop);
+    if (r < 0)
+        return r;
+
+    return decode_prop(prop, ret);
+}
 
-    property = parse_atom(pname);
+int XInputTouch::get_prop(XDevice* dev, const char *pname,
+                    std::vector<std::string> &ret)
+{
+    Atom property = parse_atom(pname);
 
     if (property == None) {
         fprintf(stderr, "invalid property '%s'\n", pname);
         return -1;
     }
 
+    return get_prop(dev, property, ret);
+}
+
+int XInputTouch::get_prop(XDevice* dev, Atom property,
+                    std::vector<std::string> &ret)
+{
+    XPropData prop;
+
+    auto r = get_prop(dev, property, prop);
+    if (r < 0)
+        return r;
+
+    return decode_prop(prop, ret);
+}
+
+int XInputTouch::get_prop(XDevice* dev, Atom property, XPropData &prop)
+{
+    int                 act_format;
+    unsigned long       bytes_after;
+    unsigned char       *data;
+
     if (XGetDeviceProperty(display, dev, property, 0, 1000, False,
-                           AnyPropertyType, &act_type, &act_format,
-                           &nitems, &bytes_after, &data) != Success)
+                           AnyPropertyType, &prop.type, &act_format,
+                           &prop.nitems, &bytes_after, &data) != Success)
         return -2;
 
-    if (nitems==0)
-        return -4;
+    prop.format = act_format;
+    prop.stride = xlib_stride(act_format);
+    prop.data.reset(data, [](const unsigned char *p) { XFree((void *)p); });
 
-    ptr = data;
+    return prop.nitems ? 0 : -4;
+}
 
-    switch(act_format)
-    {
-        case 8: size = sizeof(char); break;
-        case 16: size = sizeof(short); break;
-        case 32: size = sizeof(long); break;
-    }
+int XInputTouch::decode_prop(const XPropData &prop,
+                    std::vector<std::string> &ret)
+{
+    const unsigned char *ptr;
+    int                 j, done = False;
 
-    for (j = 0; j < (int)nitems; j++)
+    if (prop.nitems==0)
+        return -4;
+
+    ptr = prop.data.get();
+
+    for (j = 0; j < (int)prop.nitems; j++)
     {
         std::string next_value;
 
-        switch(act_type)
+        switch(prop.type)
         {
             case XA_INTEGER:
-                switch(act_format)
+                switch(prop.format)
                 {
                     case 8:
-                        next_value = std::to_string(*((char*)ptr));
+                        next_value = std::to_string(*((const char*)ptr));
                         break;
                     case 16:
-                        next_value = std::to_string(*((short*)ptr));
+                        next_value = std::to_string(*((const short*)ptr));
                         break;
                     case 32:
-                        next_value = std::to_string(*((long*)ptr));
+                        next_value = std::to_string(prop.long_at(ptr));
                         break;
                 }
                 break;
             case XA_CARDINAL:
-                switch(act_format)
+                switch(prop.format)
                 {
                     case 8:
-                        next_value = std::to_string(*((unsigned char*)ptr));
+                        next_value = std::to_string(*((const unsigned char*)ptr));
                         break;
                     case 16:
-                        next_value = std::to_string(*((unsigned short*)ptr));
+                        next_value = std::to_string(*((const unsigned short*)ptr));
                         break;
                     case 32:
-                        next_value = std::to_string(*((unsigned long*)ptr));
+                        next_value = std::to_string(prop.ulong_at(ptr));
                         break;
                 }
                 break;
             case XA_STRING:
-                if (act_format != 8)
+                if (prop.format != 8)
                 {
                     next_value = "<Unknown string format>";
                     done = True;
                     break;
                 }
-                next_value = std::string((char*)ptr);
-                j += strlen((char*)ptr); /* The loop's j++ jumps over the
+                next_value = std::string((const char*)ptr);
+                j += strlen((const char*)ptr); /* The loop's j++ jumps over the
                                             terminating 0 */
-                ptr += strlen((char*)ptr); /* ptr += size below jumps over
+                ptr += strlen((const char*)ptr); /* ptr += stride below jumps over
                                               the terminating 0 */
                 break;
             case XA_ATOM:
                 {
-                    Atom a = *(Atom*)ptr;
-                    name = (a) ? XGetAtomName(display, a) : NULL;
-                    if (name)
-                        next_value = name;
+                    Atom a = prop.ulong_at(ptr);
+                    if (a)
+                        next_value = atoms.name(a);
                     else
                         next_value = std::to_string(a);
-                    XFree(name);
                     break;
                 }
             default:
-                if (float_atom != None && act_type == float_atom)
+                if (atoms.float_atom != None && prop.type == atoms.float_atom)
                 {
-                    next_value = std::to_string(*((float*)ptr));
+                    next_value = std::to_string(prop.float_at(ptr));
                     break;
                 }
 
-                name = XGetAtomName(display, act_type);
                 next_value = "<unknown type: '";
-                next_value += name;
+                next_value += atoms.name(prop.type);
                 next_value += "'>";
-                XFree(name);
                 done = True;
                 break;
         }
 
-        ptr += size;
+        ptr += prop.stride;
 
         ret.push_back(next_value);
         if (done == True)
             break;
     }
 
-    XFree(data);
     return 0;
 }
 
 int
-XInputTouch::list_props(int dev_id,
-        std::map<std::string, std::vector<std::string>> &ret)
+XInputTouch::list_props(int dev_id, std::map<std::string, XPropData> &ret,
+        const std::vector<std::string> &filter)
 {
-    XDevice     *dev;
-    int         nprops;
-    Atom        *props;
-
-    dev = XOpenDevice(display, dev_id);
-    if (!dev)
+    auto snap = snapshot();
+    auto info = snap->find(dev_id);
+    if (!info)
     {
-        fprintf(stderr, "unable to open device '%d'\n", dev_id);
+        fprintf(stderr, "unable to find device '%d'\n", dev_id);
         return -2;
     }
 
-    props = XListDeviceProperties(display, dev, &nprops);
-    if (!nprops)
-    {
-        //printf("Device '%d' does not report any properties.\n", dev_id);
+    ret.clear();
+
+    /* fetch only the properties listed in the filter (if any) */
+    std::vector<size_t> idx;
+    for (auto i = 0u ; i < info->props.size() ; i++) {
+        if (filter.size() &&
+                std::find(filter.begin(), filter.end(), info->props[i]) ==
+                    filter.end())
+            continue;
+        idx.push_back(i);
+    }
+
+    if (!idx.size())
+        return 0;
+
+#ifdef HAVE_XCB_XINPUT
+    if (xcb) {
+        std::vector<std::pair<XID, Atom>> reqs;
+        std::vector<XPropData> data;
+
+        for (auto i : idx)
+            reqs.push_back({dev_id, info->prop_atoms[i]});
+        if (xcb->get_props(reqs, data) < 0)
+            return -2;
+
+        for (auto i = 0u ; i < idx.size() ; i++)
+            ret[info->props[idx[i]]] = data[i];
+
         return 0;
     }
+#endif
 
-    ret.clear();
-    while(nprops--) {
-        auto name = XGetAtomName(display, props[nprops]);
-        ret[name] = {};
-        get_prop(dev, name, ret[name]);
-        XFree(name);
+    auto dev = device_pool.get(dev_id);
+    if (!dev)
+    {
+        fprintf(stderr, "unable to open device '%d'\n", dev_id);
+        return -2;
     }
 
-    XFree(props);
-    XCloseDevice(display, dev);
+    for (auto i : idx)
+        get_prop(dev.get(), info->prop_atoms[i], ret[info->props[i]]);
 
     return 0;
 }
 
 int
-XInputTouch::has_prop(int dev_id, const std::string &prop_name)
+XInputTouch::list_props(int dev_id,
+        std::map<std::string, std::vector<std::string>> &ret,
+        const std::vector<std::string> &filter)
 {
-    std::map<std::string, std::vector<std::string>> ret;
+    std::map<std::string, XPropData> props;
 
-    auto r = list_props(dev_id, ret);
+    ret.clear();
 
+    auto r = list_props(dev_id, props, filter);
     if (r < 0)
         return r;
 
-    return ret.count(prop_name) ? 0 : 1;
+    for (auto &[name, value] : props)
+        decode_prop(value, ret[name]);
+
+    return 0;
+}
+
+int
+XInputTouch::has_prop(int dev_id, const std::string &prop_name)
+{
+    auto snap = snapshot();
+
+    if (!snap->find(dev_id))
+        return -2;
+
+    return snap->has_prop(dev_id, prop_name) ? 0 : 1;
 }
 
 int XInputTouch::set_prop(int devid, const char *name, Atom type, int format,
                         const std::vector<std::string> &values)
 {
-    XDevice      *dev;
     Atom          prop;
-    Atom          old_type;
     int           i;
-    int           old_format, nelements = 0;
-    unsigned long act_nitems, bytes_after;
-    union {
-        unsigned char *c;
-        short *s;
-        long *l;
-        Atom *a;
-    } data;
-
+    int           nelements = 0;
+    size_t        stride;
 
     prop = parse_atom(name);
 
@@ -391,29 +546,19 @@ int XInputTouch::set_prop(int devid, const char *name, Atom type, int format,
         return -1;
     }
 
-    dev = XOpenDevice(display, devid);
-    if (!dev)
-    {
-        fprintf(stderr, "unable to open device '%d'\n", devid);
-        return -2;
-    }
     nelements = values.size();
     if (type == None || format == 0) {
-        if (XGetDeviceProperty(display, dev, prop, 0, 0, False,
-                               AnyPropertyType,
-                               &old_type, &old_format, &act_nitems,
-                               &bytes_after, &data.c) != Success) {
+        XPropData old;
+        if (get_prop_type(devid, prop, old) < 0) {
             fprintf(stderr, "failed to get property type and format for '%s'\n",
                     name);
             return -2;
         } else {
             if (type == None)
-                type = old_type;
+                type = old.type;
             if (format == 0)
-                format = old_format;
+                format = old.format;
         }
-
-        XFree(data.c);
     }
 
     if (type == None) {
@@ -422,33 +567,38 @@ int XInputTouch::set_prop(int devid, const char *name, Atom type, int format,
         return -3;
     }
 
-    data.c = (unsigned char *)calloc(nelements, sizeof(long));
+    stride = prop_stride(format);
+    if (!stride) {
+        fprintf(stderr, "unexpected size for property '%s'", name);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<unsigned char> data(nelements * stride);
 
     for (i = 0; i < nelements; i++)
     {
+        auto ptr = data.data() + i * stride;
+
         if (type == XA_INTEGER || type == XA_CARDINAL) {
             switch (format)
             {
                 case 8:
-                    data.c[i] = stoi(values[i]);
+                    *(char *)ptr = stoi(values[i]);
                     break;
                 case 16:
-                    data.s[i] = stoi(values[i]);
+                    *(short *)ptr = stoi(values[i]);
                     break;
                 case 32:
-                    data.l[i] = stoi(values[i]);
+                    XPropData::set_long(ptr, stride, stoi(values[i]));
                     break;
-                default:
-                    fprintf(stderr, "unexpected size for property '%s'", name);
-                    return EXIT_FAILURE;
             }
-        } else if (type == float_atom) {
+        } else if (type == atoms.float_atom) {
             if (format != 32) {
                 fprintf(stderr, "unexpected format %d for property '%s'\n",
                         format, name);
                 return -3;
             }
-            *(float *)(data.l + i) = stod(values[i]);
+            XPropData::set_float(ptr, stride, stod(values[i]));
             /*FIXME: add a format check
              * if (endptr == argv[2 + i]) {
                 fprintf(stderr, "argument '%s' could not be parsed\n", argv[2 + i]);
@@ -460,18 +610,130 @@ int XInputTouch::set_prop(int devid, const char *name, Atom type, int format,
                         format, name);
                 return -4;
             }
-            data.a[i] = parse_atom(values[i].c_str());
+            XPropData::set_long(ptr, stride, parse_atom(values[i].c_str()));
         } else {
             fprintf(stderr, "unexpected type for property '%s'\n", name);
             return -5;
         }
     }
 
-    XChangeDeviceProperty(display, dev, prop, type, format, PropModeReplace,
-                          data.c, nelements);
-    free(data.c);
-    XSync(display, False);
-    XCloseDevice(display, dev);
+    return write_prop(devid, prop, type, format, nelements, data.data());
+}
+
+int XInputTouch::set_prop(int devid, const char *name,
+                        const float *values, int nelements, bool sync)
+{
+    Atom prop = parse_atom(name);
+
+    if (prop == None) {
+        fprintf(stderr, "invalid property '%s'\n", name);
+        return -1;
+    }
+
+    auto stride = prop_stride(32);
+    std::vector<unsigned char> data(nelements * stride);
+    for (int i = 0 ; i < nelements ; i++)
+        XPropData::set_float(data.data() + i * stride, stride, values[i]);
+
+    return write_prop(devid, prop, atoms.float_atom, 32, nelements,
+                      data.data(), sync);
+}
+
+int XInputTouch::set_prop(int devid, const char *name, Atom type,
+                        const long *values, int nelements)
+{
+    Atom prop = parse_atom(name);
+
+    if (prop == None) {
+        fprintf(stderr, "invalid property '%s'\n", name);
+        return -1;
+    }
+
+    auto stride = prop_stride(32);
+    std::vector<unsigned char> data(nelements * stride);
+    for (int i = 0 ; i < nelements ; i++)
+        XPropData::set_long(data.data() + i * stride, stride, values[i]);
+
+    return write_prop(devid, prop, type, 32, nelements, data.data());
+}
+
+/* 'data' is laid out as prop_stride(format) requires */
+int XInputTouch::write_prop(int devid, Atom prop, Atom type, int format,
+                        int nelements, const unsigned char *data, bool sync)
+{
+#ifdef HAVE_XCB_XINPUT
+    if (xcb)
+        return xcb->set_prop(devid, prop, type, format, nelements,
+                             data, sync) < 0 ? -2 : 0;
+#endif
+
+    auto dev = device_pool.get(devid);
+    if (!dev)
+    {
+        fprintf(stderr, "unable to open device '%d'\n", devid);
+        return -2;
+    }
+    XChangeDeviceProperty(display, dev.get(), prop, type, format,
+                          PropModeReplace, data, nelements);
+    if (sync)
+        XSync(display, False);
+    return 0;
+}
+
+/* size of an item of the given format, as the current backend wants it */
+size_t XInputTouch::prop_stride(int format)
+{
+#ifdef HAVE_XCB_XINPUT
+    /* xcb wants the 32 bit items packed */
+    if (xcb && format == 32)
+        return sizeof(uint32_t);
+#endif
+    return xlib_stride(format);
+}
+
+size_t XInputTouch::xlib_stride(int format)
+{
+    /* Xlib returns the 32 bit items as an array of long */
+    switch (format)
+    {
+        case 8: return sizeof(char);
+        case 16: return sizeof(short);
+        case 32: return sizeof(long);
+    }
+    return 0;
+}
+
+/* fetch only the type and the format of a property */
+int XInputTouch::get_prop_type(int devid, Atom prop, XPropData &ret)
+{
+#ifdef HAVE_XCB_XINPUT
+    if (xcb) {
+        std::vector<XPropData> data;
+        if (xcb->get_props({{devid, prop}}, data, 0) < 0)
+            return -2;
+        ret = data[0];
+        return 0;
+    }
+#endif
+
+    auto dev = device_pool.get(devid);
+    if (!dev)
+    {
+        fprintf(stderr, "unable to open device '%d'\n", devid);
+        return -2;
+    }
+
+    int act_format;
+    unsigned long bytes_after;
+    unsigned char *data;
+    auto r = XGetDeviceProperty(display, dev.get(), prop, 0, 0, False,
+                                AnyPropertyType, &ret.type, &act_format,
+                                &ret.nitems, &bytes_after, &data);
+    if (r != Success)
+        return -2;
+
+    ret.format = act_format;
+    XFree(data);
     return 0;
 }
 
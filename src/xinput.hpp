@@ -31,16 +31,117 @@
 #include <X11/extensions/XInput.h>
 
 
+#include <cstdint>
+#include <cstring>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 #include <utility>
 
+#include "xatoms.hpp"
+
 /* libinput calibration matrix */
 #define LICALMATR "libinput Calibration Matrix"
 /* XInput calibration matrix */
 #define XICALMATR "Coordinate Transformation Matrix"
 
+/*
+ * XInput 2 version announced by all the users of a connection: the server
+ * keeps the first one, so it has to be the highest needed (2.2 for the raw
+ * touch events of --xi2)
+ */
+#define XI2_MAJOR 2
+#define XI2_MINOR 2
+
+/*
+ * Raw value of a device property. Xlib returns the 32 bit items as an
+ * array of long, xcb packs them; 'stride' is the size of one item in
+ * 'data'.
+ */
+struct XPropData {
+    Atom            type = None;
+    int             format = 0;
+    unsigned long   nitems = 0;
+    size_t          stride = 0;
+    std::shared_ptr<const unsigned char> data;
+
+    long long_at(const unsigned char *p) const {
+        if (stride == sizeof(long))
+            return *(const long *)p;
+        return *(const int32_t *)p;
+    }
+    unsigned long ulong_at(const unsigned char *p) const {
+        if (stride == sizeof(long))
+            return *(const unsigned long *)p;
+        return *(const uint32_t *)p;
+    }
+    float float_at(const unsigned char *p) const {
+        uint32_t bits = ulong_at(p);
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    /* typed access to the i-th item */
+    size_t size() const { return nitems; }
+    const unsigned char *item(size_t i) const { return data.get() + i * stride; }
+    float get_float(size_t i) const { return float_at(item(i)); }
+    Atom get_atom(size_t i) const { return ulong_at(item(i)); }
+    long get_long(size_t i) const {
+        switch (format) {
+            case 8: return *(const char *)item(i);
+            case 16: return *(const short *)item(i);
+        }
+        return long_at(item(i));
+    }
+    unsigned long get_ulong(size_t i) const {
+        switch (format) {
+            case 8: return *(const unsigned char *)item(i);
+            case 16: return *(const unsigned short *)item(i);
+        }
+        return ulong_at(item(i));
+    }
+
+    static void set_long(unsigned char *p, size_t stride, long v) {
+        if (stride == sizeof(long))
+            *(long *)p = v;
+        else
+            *(int32_t *)p = v;
+    }
+    static void set_float(unsigned char *p, size_t stride, float f) {
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(f));
+        set_long(p, stride, bits);
+    }
+};
+
+/*
+ * Pool of the opened XDevice, keyed by XID. A device is opened the first
+ * time it is requested and stays open until it is dropped (or the pool
+ * is destroyed) and the last handle to it is released.
+ */
+class XDevicePool {
+public:
+    typedef std::shared_ptr<XDevice> XDeviceHandle;
+
+    XDevicePool(Display *display_) : display(display_) {}
+    XDevicePool(const XDevicePool &) = delete;
+    XDevicePool &operator=(const XDevicePool &) = delete;
+
+    XDeviceHandle get(XID id);
+    void drop(XID id) { devices.erase(id); }
+    void clear() { devices.clear(); }
+
+private:
+    Display *display;
+    std::map<XID, XDeviceHandle> devices;
+};
+
+#ifdef HAVE_XCB_XINPUT
+class XInputXcb;
+#endif
+
 class XInputTouch {
 public:
     struct XDevInfo {
@@ -48,6 +149,25 @@ public:
 	XID		id;
 	Atom		type;
 	std::string	type_str;
+	std::vector<std::string> props;
+	std::vector<Atom>	prop_atoms;
+    };
+
+    /*
+     * Immutable view of the input devices and of the names of their
+     * properties, taken with a single enumeration pass. It is shared
+     * between the callers until invalidate() is called.
+     */
+    class Snapshot {
+    public:
+        const std::vector<XDevInfo> &devices() const { return devs; }
+        const XDevInfo *find(XID id) const;
+        const XDevInfo *find(const std::string &name) const;
+        bool has_prop(XID id, const std::string &prop_name) const;
+
+    private:
+        friend class XInputTouch;
+        std::vector<XDevInfo> devs;
     };
 
     XInputTouch(Display *display);
@@ -55,46 +175,77 @@ public:
     ~XInputTouch();
 
     int find_touch(std::vector<XDevInfo> &ret);
+    /* an empty 'filter' means all the properties */
     int list_props(int dev_id,
-                        std::map<std::string, std::vector<std::string>> &ret);
+                        std::map<std::string, std::vector<std::string>> &ret,
+                        const std::vector<std::string> &filter = {});
+    int list_props(int dev_id, std::map<std::string, XPropData> &ret,
+                        const std::vector<std::string> &filter = {});
     int set_prop(int devid, const char *name, Atom type, int format,
                         const std::vector<std::string> &values);
     int set_prop(int devid, const char *name,
             const std::vector<std::string> &values) {
                 return set_prop(devid, name, 0, 0, values);
     }
+    /*
+     * typed writes: a FLOAT property, or a 32 bit INTEGER/CARDINAL/ATOM one;
+     * without 'sync' the caller has to XSync() (the errors are reported
+     * asynchronously)
+     */
+    int set_prop(int devid, const char *name,
+                        const float *values, int nelements, bool sync = true);
+    int set_prop(int devid, const char *name, Atom type,
+                        const long *values, int nelements);
     int get_prop(XDevice* dev, const char *name,
                         std::vector<std::string> &ret);
     int get_prop(int devid, const char *name,
                         std::vector<std::string> &ret);
+    /* typed read: the returned value points into the server reply */
+    int get_prop(int devid, const char *name, XPropData &ret);
+    /* convert a value to its string form */
+    int decode_prop(const XPropData &prop, std::vector<std::string> &ret);
     int has_prop(int devid, const std::string &prop_name);
 
     std::vector<XDevInfo> list_devices();
 
+    /*
+     * Look up a device by id or, if the id is (XID)-1, by name; when
+     * neither is given pick the default touch (see find_touch()). Return
+     * 0 on success, -1 if there isn't a single default touch ('candidates'
+     * contains the alternatives), -2 if the device doesn't exist.
+     */
+    int resolve_device(XID &id, std::string &name,
+                       std::vector<XDevInfo> &candidates);
+    /*
+     * Check that the device has the calibration matrix 'matrix_name'; if
+     * it is empty, pick LICALMATR or else XICALMATR. Return -1 if none
+     * is available.
+     */
+    int resolve_matrix(XID id, std::string &matrix_name);
+
+    std::shared_ptr<const Snapshot> snapshot();
+    /* forget the cached snapshot and the opened devices */
+    void invalidate() { cached_snapshot.reset(); device_pool.clear(); }
+
 private:
 
+    std::shared_ptr<const Snapshot> cached_snapshot;
+#ifdef HAVE_XCB_XINPUT
+    std::unique_ptr<XInputXcb> xcb;
+#endif
+
+    int get_prop(XDevice* dev, Atom property,
+                        std::vector<std::string> &ret);
+    int get_prop(XDevice* dev, Atom property, XPropData &ret);
+    int get_prop_type(int devid, Atom property, XPropData &ret);
+    int write_prop(int devid, Atom prop, Atom type, int format,
+                        int nelements, const unsigned char *data,
+                        bool sync = true);
+    size_t prop_stride(int format);
+    static size_t xlib_stride(int format);
     Atom parse_atom(const char *name);
-    std::string type_to_string(Atom type);
     Display *display;
-    Atom xi_touchscreen;
-    Atom xi_mouse;
-    Atom xi_keyboard;
-    Atom float_atom;
-    Atom xi_tablet;
-    Atom xi_touchpad;
-    Atom xi_buttonbox;
-    Atom xi_barcode;
-    Atom xi_trackball;
-    Atom xi_quadrature;
-    Atom xi_id_module;
-    Atom xi_one_knob;
-    Atom xi_nine_knob;
-    Atom xi_knob_box;
-    Atom xi_spaceball;
-    Atom xi_dataglove;
-    Atom xi_eyetracker;
-    Atom xi_cursorkeys;
-    Atom xi_footmouse;
-    Atom xi_joystick;
+    XAtoms &atoms;
+    XDevicePool device_pool;
 
 };
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2024 Goffredo Baroncelli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <X11/Xlib-xcb.h>
+#include <xcb/xinput.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "xinput_xcb.hpp"
+
+XInputXcb::XInputXcb(Display *display) {
+    conn = XGetXCBConnection(display);
+    if (!conn || xcb_connection_has_error(conn))
+        return;
+
+    /* the server refuses the XI2 requests until the version is announced */
+    auto cookie = xcb_input_xi_query_version(conn, XI2_MAJOR, XI2_MINOR);
+    auto reply = xcb_input_xi_query_version_reply(conn, cookie, nullptr);
+    if (!reply)
+        return;
+
+    ok = reply->major_version >= 2;
+    free(reply);
+}
+
+int XInputXcb::list_props(const std::vector<XID> &devs,
+                          std::vector<std::vector<Atom>> &ret) {
+    std::vector<xcb_input_xi_list_properties_cookie_t> cookies;
+
+    for (auto id : devs)
+        cookies.push_back(xcb_input_xi_list_properties(conn, id));
+
+    ret.clear();
+    ret.resize(devs.size());
+
+    int r = 0;
+    for (auto i = 0u ; i < cookies.size() ; i++) {
+        auto reply = xcb_input_xi_list_properties_reply(conn, cookies[i],
+                                                        nullptr);
+        if (!reply) {
+            r = -2;
+            continue;
+        }
+
+        auto atoms = xcb_input_xi_list_properties_properties(reply);
+        auto n = xcb_input_xi_list_properties_properties_length(reply);
+        ret[i].assign(atoms, atoms + n);
+        free(reply);
+    }
+
+    return r;
+}
+
+int XInputXcb::get_props(const std::vector<std::pair<XID, Atom>> &reqs,
+                         std::vector<XPropData> &ret, unsigned long len) {
+    std::vector<xcb_input_xi_get_property_cookie_t> cookies;
+
+    for (auto &[id, prop] : reqs)
+        cookies.push_back(xcb_input_xi_get_property(conn, id, false, prop,
+                                                    XCB_ATOM_ANY, 0, len));
+
+    ret.clear();
+    ret.resize(reqs.size());
+
+    int r = 0;
+    for (auto i = 0u ; i < cookies.size() ; i++) {
+        auto reply = xcb_input_xi_get_property_reply(conn, cookies[i],
+                                                     nullptr);
+        if (!reply) {
+            r = -2;
+            continue;
+        }
+
+        auto &p = ret[i];
+        p.type = reply->type;
+        p.format = reply->format;
+        p.nitems = reply->num_items;
+        p.stride = reply->format / 8;
+
+        /* the items live inside the reply, don't copy them */
+        std::shared_ptr<xcb_input_xi_get_property_reply_t> owner(reply, free);
+        p.data = std::shared_ptr<const unsigned char>(owner,
+                    (const unsigned char *)xcb_input_xi_get_property_items(reply));
+    }
+
+    return r;
+}
+
+int XInputXcb::set_prop(XID devid, Atom prop, Atom type, int format,
+                        unsigned long nitems, const void *data, bool checked) {
+    if (!checked) {
+        xcb_input_xi_change_property(conn, devid, XCB_PROP_MODE_REPLACE,
+                                     format, prop, type, nitems, data);
+        return 0;
+    }
+
+    auto cookie = xcb_input_xi_change_property_checked(conn, devid,
+                    XCB_PROP_MODE_REPLACE, format, prop, type, nitems, data);
+
+    auto err = xcb_request_check(conn, cookie);
+    if (err) {
+        fprintf(stderr, "unable to change the property of device '%lu' (error %d)\n",
+                devid, err->error_code);
+        free(err);
+        return -2;
+    }
+
+    return 0;
+}
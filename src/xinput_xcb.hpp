@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2024 Goffredo Baroncelli
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <X11/Xlib.h>
+#include <xcb/xcb.h>
+
+#include <utility>
+#include <vector>
+
+#include "xinput.hpp"
+
+/*
+ * Property backend built on xcb-xinput. It shares the connection of the
+ * Xlib Display, and for every batch it sends all the requests before
+ * collecting any reply, so N properties cost about one round trip.
+ */
+class XInputXcb {
+public:
+    XInputXcb(Display *display);
+
+    bool valid() const { return ok; }
+
+    /* list the properties of each device in 'devs' */
+    int list_props(const std::vector<XID> &devs,
+                   std::vector<std::vector<Atom>> &ret);
+
+    /*
+     * fetch the (device, property) pairs in 'reqs'; 'len' is the
+     * maximum number of 32 bit units returned for each property
+     */
+    int get_props(const std::vector<std::pair<XID, Atom>> &reqs,
+                  std::vector<XPropData> &ret, unsigned long len = 1000);
+
+    /*
+     * 'data' contains 'nitems' items packed as 'format' bits each; without
+     * 'checked' the request is only queued, and an error goes to the Xlib
+     * error handler
+     */
+    int set_prop(XID devid, Atom prop, Atom type, int format,
+                 unsigned long nitems, const void *data, bool checked = true);
+
+private:
+    xcb_connection_t *conn = nullptr;
+    bool ok = false;
+};